@@ -0,0 +1,100 @@
+#include <mpi.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "dsm.h"
+
+// Compares the home-based compare-and-exchange with the broadcast path it replaced (read the local copy,
+// write the new value to every subscriber and wait for them to have it), then checks that contended CAS
+// increments of one counter are never lost.
+//
+// Usage: mpirun -np <P> cas_bench [iterations] [rma]
+
+using Clock = std::chrono::steady_clock;
+
+static double micros(Clock::duration elapsed) {
+    return std::chrono::duration<double, std::micro>(elapsed).count();
+}
+
+static void report(const std::string &label, std::vector<double> &samples) {
+    std::sort(samples.begin(), samples.end());
+    const double median = samples[samples.size() / 2];
+    const double p99 = samples[std::min(samples.size() - 1, samples.size() * 99 / 100)];
+    std::cout << label << ": median " << median << " us, p99 " << p99 << " us over " << samples.size()
+            << " operations" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &provided);
+
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    if (provided < MPI_THREAD_MULTIPLE || size < 2) {
+        if (rank == 0) {
+            std::cerr << "Needs MPI_THREAD_MULTIPLE and at least 2 processes" << std::endl;
+        }
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    const int iterations = argc > 1 ? std::stoi(argv[1]) : 1000;
+    const DSM::Backend backend = argc > 2 && std::string(argv[2]) == "rma" ? DSM::Backend::RMA : DSM::Backend::MESSAGES;
+
+    {
+        DSM dsm(rank, size, {}, backend);
+        // Ids are handed out in subscription order, so "lease" is id 0 and has rank 0 as its home
+        const int lease = dsm.subscribe("lease");
+        const int counter = dsm.subscribe("counter");
+        MPI_Barrier(MPI_COMM_WORLD);
+
+        // Uncontended latency, measured on the last rank against a variable homed elsewhere
+        if (rank == size - 1) {
+            std::vector<double> cas_samples, broadcast_samples;
+            for (int i = 0; i < iterations; ++i) {
+                const int current = dsm.read(lease);
+                auto start = Clock::now();
+                dsm.compare_and_exchange(lease, current, current + 1);
+                cas_samples.push_back(micros(Clock::now() - start));
+
+                start = Clock::now();
+                if (dsm.read(lease) == current + 1) {
+                    dsm.write(lease, current + 2);
+                    dsm.flush();
+                }
+                broadcast_samples.push_back(micros(Clock::now() - start));
+            }
+            report("home CAS", cas_samples);
+            report("broadcast read+write+flush", broadcast_samples);
+        }
+        MPI_Barrier(MPI_COMM_WORLD);
+
+        // Contended: everybody increments the counter, retrying on a lost race
+        std::vector<double> contended;
+        int retries = 0;
+        for (int i = 0; i < iterations; ++i) {
+            const auto start = Clock::now();
+            int current = dsm.read(counter, DSM::Consistency::MONOTONIC);
+            while (!dsm.compare_and_exchange(counter, current, current + 1)) {
+                ++retries;
+                current = dsm.read(counter, DSM::Consistency::MONOTONIC);
+            }
+            contended.push_back(micros(Clock::now() - start));
+        }
+
+        const int expected_total = INITIALIZED + size * iterations;
+        dsm.when(counter, [expected_total](int value) { return value == expected_total; }).wait();
+        if (rank == 0) {
+            report("contended CAS increment", contended);
+            std::cout << "counter reached " << dsm.read(counter) << " (expected " << expected_total << "), rank 0 retried "
+                    << retries << " times" << std::endl;
+        }
+    }
+
+    MPI_Finalize();
+    return 0;
+}
@@ -1,10 +1,24 @@
 #include "dsm.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
 #include <iostream>
+#include <map>
 #include <mpi.h>
+#include <numeric>
+#include <stdexcept>
 
-DSM::DSM(int rank, int size) : rank(rank), size(size) {
-    std::cout << "DSM constructor called" << std::endl << "Rank: " << rank << std::endl << "Size: " << size <<
-            std::endl;
+// The progress thread spins this many empty polls before it starts napping between them
+static const int SPIN_ROUNDS = 64;
+static const auto IDLE_SLEEP = std::chrono::microseconds(50);
+
+DSM::DSM(int rank, int size, Executor executor, Backend backend, int rma_capacity) : rank(rank), size(size),
+    executor(std::move(executor)), backend(backend), rma_capacity(rma_capacity) {
+    if constexpr (DSM_LOG_LEVEL >= 2) {
+        std::cout << "DSM constructor called" << std::endl << "Rank: " << rank << std::endl << "Size: " << size <<
+                std::endl;
+    }
 
     for (int i = 0; i < size; ++i) {
         // Initialize all the other_processes
@@ -12,111 +26,1023 @@ DSM::DSM(int rank, int size) : rank(rank), size(size) {
             other_processes.push_back(i);
         }
     }
+
+    if (!this->executor) {
+        this->executor = [](Task task) { task(); }; // Run callbacks right on the progress thread
+    }
+    MPI_Comm_dup(MPI_COMM_WORLD, &comm);
+    find_nodes();
+    if (backend == Backend::RMA) {
+        setup_windows();
+    }
+    progress = std::jthread([this](std::stop_token stop) { progress_loop(stop); });
+}
+
+DSM::~DSM() {
+    // Our own sends are done once flush() returns; the progress thread then keeps serving (and relaying)
+    // until no message is left in flight anywhere
+    flush();
+    progress.request_stop();
+    progress.join();
+
+    if (backend == Backend::RMA) {
+        free_windows();
+    }
+    MPI_Comm_free(&comm);
+}
+
+void DSM::find_nodes() {
+    // A node is named after the lowest world rank on it
+    MPI_Comm node;
+    MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &node);
+    int leader = rank;
+    MPI_Bcast(&leader, 1, MPI_INT, 0, node);
+    MPI_Comm_free(&node);
+
+    node_of.resize(size);
+    MPI_Allgather(&leader, 1, MPI_INT, node_of.data(), 1, MPI_INT, comm);
+}
+
+void DSM::setup_windows() {
+    rma_slots = (rma_capacity + size - 1) / size;
+    const MPI_Aint bytes = static_cast<MPI_Aint>(rma_slots) * sizeof(int);
+
+    // Our segment comes out of memory the whole node can map; the world window exposes the same memory
+    // to processes on other nodes
+    MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &node_comm);
+    int *segment;
+    MPI_Win_allocate_shared(bytes, sizeof(int), MPI_INFO_NULL, node_comm, &segment, &node_win);
+    std::fill(segment, segment + rma_slots, INITIALIZED);
+    MPI_Win_create(segment, bytes, sizeof(int), MPI_INFO_NULL, comm, &world_win);
+
+    // Where the other segments of our node are mapped, by world rank
+    int node_size;
+    MPI_Comm_size(node_comm, &node_size);
+    std::vector<int> node_ranks(node_size), world_ranks(node_size);
+    std::iota(node_ranks.begin(), node_ranks.end(), 0);
+    MPI_Group node_group, world_group;
+    MPI_Comm_group(node_comm, &node_group);
+    MPI_Comm_group(comm, &world_group);
+    MPI_Group_translate_ranks(node_group, node_size, node_ranks.data(), world_group, world_ranks.data());
+    MPI_Group_free(&node_group);
+    MPI_Group_free(&world_group);
+
+    shared_segments.assign(size, nullptr);
+    for (int i = 0; i < node_size; ++i) {
+        MPI_Aint segment_bytes;
+        int unit;
+        int *base;
+        MPI_Win_shared_query(node_win, i, &segment_bytes, &unit, &base);
+        shared_segments[world_ranks[i]] = base;
+    }
+
+    // One passive-target epoch for the DSM's whole life; every slot is initialised before anybody reads it
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, world_win);
+    MPI_Barrier(comm);
 }
 
-void DSM::subscribe(const std::string &var_name, bool broadcast) {
-    subscribers[var_name].insert(rank); // Add this process as a subscriber
-    variables[var_name] = INITIALIZED; // Initialize the variable
+void DSM::free_windows() {
+    MPI_Win_unlock_all(world_win);
+    MPI_Win_free(&world_win);
+    MPI_Win_free(&node_win);
+    MPI_Comm_free(&node_comm);
+}
 
-    // Subscribe to the variable in all other processes
-    for (int process_rank: other_processes) {
-        subscribers[var_name].insert(process_rank);
+int DSM::slot_load(int var_id) const {
+    const int home = home_of(var_id);
+    if (shared_segments[home]) {
+        return std::atomic_ref(shared_segments[home][slot_of(var_id)]).load();
     }
 
-    if (!broadcast) {
+    int value;
+    MPI_Fetch_and_op(nullptr, &value, MPI_INT, home, slot_of(var_id), MPI_NO_OP, world_win);
+    MPI_Win_flush(home, world_win);
+    return value;
+}
+
+void DSM::slot_store(int var_id, int value) {
+    const int home = home_of(var_id);
+    if (shared_segments[home]) {
+        std::atomic_ref(shared_segments[home][slot_of(var_id)]).store(value);
         return;
     }
 
-    // Notify all other processes that this process is subscribing to the variable
-    broadcast_subscription(var_name);
+    // An atomic put: a plain MPI_Put racing with somebody's MPI_Compare_and_swap on the slot is undefined
+    MPI_Accumulate(&value, 1, MPI_INT, home, slot_of(var_id), 1, MPI_INT, MPI_REPLACE, world_win);
+    MPI_Win_flush(home, world_win);
+}
+
+bool DSM::home_swap(int var_id, int expected, int new_value) {
+    const int home = home_of(var_id);
+    if (shared_segments[home]) {
+        return std::atomic_ref(shared_segments[home][slot_of(var_id)]).compare_exchange_strong(expected, new_value);
+    }
+
+    int found;
+    MPI_Compare_and_swap(&new_value, &expected, &found, MPI_INT, home, slot_of(var_id), world_win);
+    MPI_Win_flush(home, world_win);
+    return found == expected;
+}
+
+bool DSM::poll_windows() {
+    // Which variables to look at, and how many of our own writes each had so far
+    std::vector<int> polled;
+    std::vector<unsigned> writes_seen;
+    {
+        std::lock_guard lock(mtx);
+        for (int var_id = 0; var_id < static_cast<int>(names.size()); ++var_id) {
+            if (!names[var_id].empty() && !dirty[var_id] && objects[var_id].empty()) {
+                polled.push_back(var_id);
+                writes_seen.push_back(local_writes[var_id]);
+            }
+        }
+    }
+    if (polled.empty()) {
+        return false;
+    }
+
+    // Slots on our node are read in place; every other home gets one atomic read of all its slots we need
+    std::vector<int> fetched(polled.size());
+    std::vector<std::vector<int>> remote_slots(size);
+    for (std::size_t i = 0; i < polled.size(); ++i) {
+        const int home = home_of(polled[i]);
+        if (shared_segments[home]) {
+            fetched[i] = std::atomic_ref(shared_segments[home][slot_of(polled[i])]).load();
+        } else if (static_cast<int>(remote_slots[home].size()) <= slot_of(polled[i])) {
+            remote_slots[home].resize(slot_of(polled[i]) + 1);
+        }
+    }
+    bool remote = false;
+    for (int home = 0; home < size; ++home) {
+        std::vector<int> &slots = remote_slots[home];
+        if (!slots.empty()) {
+            const int count = static_cast<int>(slots.size());
+            MPI_Get_accumulate(nullptr, 0, MPI_INT, slots.data(), count, MPI_INT, home, 0, count, MPI_INT, MPI_NO_OP,
+                               world_win);
+            remote = true;
+        }
+    }
+    if (remote) {
+        MPI_Win_flush_all(world_win);
+        for (std::size_t i = 0; i < polled.size(); ++i) {
+            const int home = home_of(polled[i]);
+            if (!shared_segments[home]) {
+                fetched[i] = remote_slots[home][slot_of(polled[i])];
+            }
+        }
+    }
+
+    std::vector<Task> after;
+    {
+        std::lock_guard lock(mtx);
+        for (std::size_t i = 0; i < polled.size(); ++i) {
+            const int var_id = polled[i];
+            // Skip anything we wrote in the meantime: what we fetched may predate it
+            if (local_writes[var_id] == writes_seen[i] && !dirty[var_id] && values[var_id] != fetched[i]) {
+                apply_locked(var_id, fetched[i], stamp_locked(), true, after);
+            }
+        }
+    }
+    for (Task &task: after) {
+        task();
+    }
+    return !after.empty();
+}
+
+int DSM::subscribe(const std::string &var_name) {
+    const int var_id = intern(var_name, 0);
+    if (size_of(var_id) != 0) {
+        throw std::invalid_argument("DSM variable " + var_name + " is an object, not an int");
+    }
+    return var_id;
+}
+
+int DSM::share(const std::string &var_name, std::size_t bytes) {
+    if (bytes == 0) {
+        throw std::invalid_argument("DSM object " + var_name + " needs a size");
+    }
+    const int var_id = intern(var_name, bytes);
+    if (size_of(var_id) != bytes) {
+        throw std::invalid_argument("DSM variable " + var_name + " was shared with another size");
+    }
+    return var_id;
+}
+
+int DSM::intern(const std::string &var_name, std::size_t bytes) {
+    std::unique_lock lock(mtx);
+    auto it = ids.find(var_name);
+    if (it != ids.end()) {
+        return it->second; // Whoever was first decided its size
+    }
+
+    if (rank == 0) {
+        // We hand out the ids: take the next one and let everybody know
+        if (backend == Backend::RMA && next_id == rma_capacity) {
+            std::cerr << "The DSM windows are full (" << rma_capacity << " variables)" << std::endl;
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        const int var_id = next_id++;
+        std::vector<Task> after;
+        bind_locked(var_id, var_name, bytes, after);
+        lock.unlock();
+
+        announce(var_id, var_name, bytes);
+        for (Task &task: after) {
+            task();
+        }
+        return var_id;
+    }
+
+    // Ask rank 0; the progress thread wakes us up once its announcement is in.
+    // The send may block, and the progress thread needs mtx meanwhile
+    std::vector<int> request{static_cast<int>(bytes)};
+    request.insert(request.end(), var_name.begin(), var_name.end());
+    lock.unlock();
+    MPI_Send(request.data(), static_cast<int>(request.size()), MPI_INT, 0, INTERN, comm);
+    lock.lock();
+    bound_cv.wait(lock, [this, &var_name] { return ids.count(var_name) > 0; });
+    return ids[var_name];
+}
+
+int DSM::id_of(const std::string &var_name) const {
+    std::lock_guard lock(mtx);
+    auto it = ids.find(var_name);
+    return it == ids.end() ? -1 : it->second;
 }
 
+bool DSM::has_value(int var_id) const {
+    std::lock_guard lock(mtx);
+    return assigned[var_id];
+}
+
+std::size_t DSM::size_of(int var_id) const {
+    std::lock_guard lock(mtx);
+    return objects[var_id].size();
+}
 
-void DSM::broadcast_subscription(const std::string &var_name) {
-    int var_name_length = var_name.length();
-    const char *var_name_cstr = var_name.c_str();
+void DSM::bind_locked(int var_id, const std::string &var_name, std::size_t bytes, std::vector<Task> &after) {
+    if (var_id >= static_cast<int>(names.size())) {
+        names.resize(var_id + 1);
+        values.resize(var_id + 1, INITIALIZED); // Initialize the variable
+        versions.resize(var_id + 1);
+        subscribers.resize(var_id + 1);
+        waiters.resize(var_id + 1);
+        dirty.resize(var_id + 1, 0);
+        local_writes.resize(var_id + 1, 0);
+        assigned.resize(var_id + 1, 0);
+        objects.resize(var_id + 1);
+        dirty_spans.resize(var_id + 1);
+        pins.resize(var_id + 1, 0);
+    }
+    names[var_id] = var_name;
+    ids[var_name] = var_id;
+    objects[var_id].assign(bytes, std::byte{0});
+    dirty_spans[var_id].assign((bytes + CHUNK - 1) / CHUNK, {0, 0});
 
     // By default, we assume that the subscribers
     // are going to be the whole rest of processes
-    for (int subscriber_rank: other_processes) {
-        if (subscriber_rank != rank) {
-            MPI_Send(var_name_cstr, var_name_length, MPI_CHAR, subscriber_rank, SUBSCRIBE, MPI_COMM_WORLD);
+    subscribers[var_id] = other_processes;
+
+    // Updates from processes that learned the id before us were parked until now
+    std::size_t kept = 0;
+    for (const Update &update: unbound_updates) {
+        if (update.var_id == var_id) {
+            apply_locked(var_id, update.value, update.version, true, after);
+        } else {
+            unbound_updates[kept++] = update;
+        }
+    }
+    unbound_updates.resize(kept);
+
+    // Same for requests that reached us, the home, before the binding did
+    kept = 0;
+    for (const HomeRequest &request: unbound_requests) {
+        if (request.var_id == var_id) {
+            serve_locked(request, after);
+        } else {
+            unbound_requests[kept++] = request;
+        }
+    }
+    unbound_requests.resize(kept);
+
+    drain_parked_locked(after);
+}
+
+bool DSM::apply_locked(int var_id, int value, Version version, bool remote, std::vector<Task> &after) {
+    lamport = std::max(lamport, version.clock);
+    if (version <= versions[var_id]) {
+        return false; // Overtaken by something newer we already have
+    }
+    values[var_id] = value;
+    versions[var_id] = version;
+    assigned[var_id] = 1;
+
+    // Remote changes go to the callback, through the executor
+    if (remote && callback) {
+        after.push_back([this, name = names[var_id], value] {
+            executor([this, name, value] { callback(name, value, rank); });
+        });
+    }
+
+    // Resolve every when() whose condition now holds
+    std::vector<Waiter> &pending = waiters[var_id];
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < pending.size(); ++i) {
+        if (pending[i].condition(value)) {
+            auto promise = std::make_shared<std::promise<int>>(std::move(pending[i].promise));
+            after.push_back([promise, value] { promise->set_value(value); });
+        } else {
+            if (kept != i) {
+                pending[kept] = std::move(pending[i]);
+            }
+            ++kept;
         }
     }
+    pending.resize(kept);
+    return true;
 }
 
-void DSM::write(const std::string &var_name, int value) {
-    std::cout << "Previous value: " << variables[var_name] << "Writing to variable: " << var_name << " with value: " <<
-            value << std::endl;
+void DSM::announce(int var_id, const std::string &var_name, std::size_t bytes) {
+    // The id, then the name one char per int: names are short and this way the relays treat it like any update
+    std::vector<int> payload{var_id, static_cast<int>(bytes)};
+    payload.insert(payload.end(), var_name.begin(), var_name.end());
 
-    variables[var_name] = value; // Write locally
-    int var_name_length = var_name.length();
-    const char *var_name_cstr = var_name.c_str();
+    std::lock_guard lock(mtx);
+    multicast_locked(other_processes, SUBSCRIBE, payload);
+}
 
-    // Notify all subscribers
-    for (int process_rank: subscribers[var_name]) {
-        if (process_rank != rank) {
-            // first, we send the variable name such that the receiver can update its local copy
-            MPI_Send(var_name_cstr, var_name_length, MPI_CHAR, process_rank, VALUE_WRITE, MPI_COMM_WORLD);
+void DSM::multicast_locked(std::vector<int> destinations, int tag, const std::vector<int> &payload,
+                           const OutgoingData *data) {
+    // Node by node: the subtrees the relays get are contiguous, so only the first few hops cross nodes
+    std::sort(destinations.begin(), destinations.end(), [this](int a, int b) {
+        return std::pair(node_of[a], a) < std::pair(node_of[b], b);
+    });
+    relay_locked(destinations.data(), destinations.data() + destinations.size(), tag, payload, data);
+}
 
-            // then we send the updated value
-            MPI_Send(&value, 1, MPI_INT, process_rank, VALUE_WRITE, MPI_COMM_WORLD);
+void DSM::relay_locked(const int *first, const int *last, int tag, const std::vector<int> &payload,
+                       const OutgoingData *data) {
+    // Binomial split: the middle process gets the upper half to pass on, we keep halving the lower one.
+    // That is log2(n) sends here and log2(n) hops until the last process has it.
+    while (first != last) {
+        const int *middle = first + (last - first) / 2;
+        std::vector<int> message{static_cast<int>(last - middle - 1)};
+        message.insert(message.end(), middle + 1, last);
+        message.insert(message.end(), payload.begin(), payload.end());
+        send_locked(*middle, tag, std::move(message));
+        if (data) {
+            send_data_locked(*middle, *data);
         }
+        last = middle;
     }
 }
 
-bool DSM::compare_and_exchange(const std::string &var_name, int expected, int new_value) {
-    std::cerr << "Searching for variable: '" << var_name << "'\n";
-    for (const auto &[key, value]: variables) {
-        std::cerr << "Existing variable: '" << key << "'\n";
+void DSM::write(int var_id, int value, Consistency level) {
+    std::vector<Task> after;
+    std::future<bool> ordered;
+    {
+        std::lock_guard lock(mtx);
+        if constexpr (DSM_LOG_LEVEL >= 2) {
+            std::cout << "Previous value: " << values[var_id] << "Writing to variable: " << names[var_id] <<
+                    " with value: " << value << std::endl;
+        }
+
+        if (level == Consistency::SEQUENTIAL && backend == Backend::MESSAGES) {
+            // The home stamps it and puts it in its order; wait until it comes back to us
+            if (home_of(var_id) == rank) {
+                ordered_write_locked(var_id, value, rank, -1, after);
+            } else {
+                ordered = ask_home_locked(var_id, ORDERED_WRITE, {var_id, value});
+            }
+        } else {
+            apply_locked(var_id, value, stamp_locked(), false, after); // Write locally
+            ++local_writes[var_id];
+
+            if (level == Consistency::SEQUENTIAL) {
+                slot_store(var_id, value); // RMA: right into the home's slot, batch or not
+            } else {
+                // A write outside of any batch is a batch of one
+                if (!dirty[var_id]) {
+                    dirty[var_id] = 1;
+                    dirty_ids.push_back(var_id);
+                }
+                if (batch_depth == 0) {
+                    send_updates_locked();
+                }
+            }
+        }
+    }
+    for (Task &task: after) {
+        task();
+    }
+    if (ordered.valid()) {
+        ordered.wait();
+    }
+}
+
+void DSM::write(const std::string &var_name, int value, Consistency level) {
+    write(subscribe(var_name), value, level);
+}
+
+int DSM::read(int var_id, Consistency level) {
+    std::future<int> answer;
+    {
+        std::lock_guard lock(mtx);
+        // Our own batch is the newest there is, as far as we are concerned
+        if (level == Consistency::RELAXED || dirty[var_id] ||
+            (level == Consistency::MONOTONIC && backend == Backend::MESSAGES) ||
+            (level == Consistency::SEQUENTIAL && home_of(var_id) == rank && backend == Backend::MESSAGES)) {
+            return values[var_id];
+        }
+
+        if (backend == Backend::MESSAGES) {
+            reap_sends_locked();
+            const int token = next_token++;
+            answer = pending_reads[token].get_future();
+            send_locked(home_of(var_id), READ_REQUEST, {token, var_id});
+        }
+    }
+    return answer.valid() ? answer.get() : slot_load(var_id);
+}
+
+int DSM::read(const std::string &var_name, Consistency level) {
+    return read(subscribe(var_name), level);
+}
+
+void DSM::write_bytes(int var_id, std::size_t offset, const void *data, std::size_t length) {
+    while (true) {
+        {
+            std::lock_guard lock(mtx);
+            std::vector<std::byte> &object = objects[var_id];
+            if (offset + length > object.size()) {
+                throw std::out_of_range("Write past the end of DSM object " + names[var_id]);
+            }
+
+            reap_sends_locked();
+            if (pins[var_id] == 0) {
+                std::memcpy(object.data() + offset, data, length);
+                assigned[var_id] = 1;
+                for (std::size_t chunk = offset / CHUNK; chunk * CHUNK < offset + length; ++chunk) {
+                    // Widen the chunk's span by the part of the write that falls into it
+                    const int first = static_cast<int>(std::max(offset, chunk * CHUNK));
+                    const int last = static_cast<int>(std::min(offset + length, (chunk + 1) * CHUNK));
+                    auto &[span_first, span_last] = dirty_spans[var_id][chunk];
+                    if (span_first == span_last) {
+                        span_first = first;
+                        span_last = last;
+                    } else {
+                        span_first = std::min(span_first, first);
+                        span_last = std::max(span_last, last);
+                    }
+                }
+
+                if (!dirty[var_id]) {
+                    dirty[var_id] = 1;
+                    dirty_ids.push_back(var_id);
+                }
+                if (batch_depth == 0) {
+                    send_updates_locked();
+                }
+                return;
+            }
+        }
+
+        // A send of ours still reads the object: wait it out, without the lock since the receiver may need ours
+        flush();
+    }
+}
+
+void DSM::read_bytes(int var_id, std::size_t offset, void *out, std::size_t length) const {
+    std::lock_guard lock(mtx);
+    const std::vector<std::byte> &object = objects[var_id];
+    if (offset + length > object.size()) {
+        throw std::out_of_range("Read past the end of DSM object " + names[var_id]);
+    }
+    std::memcpy(out, object.data() + offset, length);
+}
+
+std::future<int> DSM::when(int var_id, std::function<bool(int)> condition) {
+    std::lock_guard lock(mtx);
+    std::promise<int> promise;
+    std::future<int> future = promise.get_future();
+
+    if (condition(values[var_id])) {
+        promise.set_value(values[var_id]);
+    } else {
+        waiters[var_id].push_back(Waiter{std::move(condition), std::move(promise)});
+    }
+    return future;
+}
+
+std::future<int> DSM::when(const std::string &var_name, std::function<bool(int)> condition) {
+    return when(subscribe(var_name), std::move(condition));
+}
+
+void DSM::begin_batch() {
+    std::lock_guard lock(mtx);
+    ++batch_depth;
+}
+
+void DSM::commit() {
+    std::lock_guard lock(mtx);
+    if (batch_depth == 0 || --batch_depth > 0) {
+        return;
+    }
+    send_updates_locked();
+}
+
+void DSM::send_updates_locked() {
+    if (dirty_ids.empty()) {
+        return;
+    }
+    reap_sends_locked();
+
+    // Group the updates by destination, so every subscriber gets exactly one message. Objects go on their own.
+    std::vector<std::vector<int>> per_destination(size, std::vector<int>{-1, -1});  // Nobody's request
+    for (int var_id: dirty_ids) {
+        dirty[var_id] = 0;
+        if (!objects[var_id].empty()) {
+            send_object_locked(var_id);
+        } else if (backend == Backend::RMA) {
+            slot_store(var_id, values[var_id]);
+        } else {
+            for (int process_rank: subscribers[var_id]) {
+                per_destination[process_rank].insert(per_destination[process_rank].end(),
+                                                     {var_id, values[var_id], versions[var_id].clock,
+                                                      versions[var_id].writer});
+            }
+        }
+    }
+    dirty_ids.clear();
+
+    // Subscribers getting the very same updates (usually all of them) share one multicast
+    std::map<std::vector<int>, std::vector<int>> destinations;
+    for (int destination = 0; destination < size; ++destination) {
+        if (per_destination[destination].size() > 2) {
+            destinations[std::move(per_destination[destination])].push_back(destination);
+        }
+    }
+    for (auto &[records, group]: destinations) {
+        multicast_locked(std::move(group), VALUE_WRITE, records);
+    }
+}
+
+void DSM::send_object_locked(int var_id) {
+    // The chunks' spans become the ranges; spans that meet at a chunk border are joined
+    std::vector<int> payload{var_id, 0};
+    std::vector<int> lengths;
+    std::vector<MPI_Aint> displacements;
+    for (auto &[first, last]: dirty_spans[var_id]) {
+        if (first == last) {
+            continue;
+        }
+        if (!lengths.empty() && displacements.back() + lengths.back() == first) {
+            lengths.back() += last - first;
+        } else {
+            displacements.push_back(first);
+            lengths.push_back(last - first);
+        }
+        first = last = 0;
+    }
+    for (std::size_t i = 0; i < lengths.size(); ++i) {
+        payload.push_back(static_cast<int>(displacements[i]));
+        payload.push_back(lengths[i]);
+    }
+    if (lengths.empty()) {
+        return;
+    }
+    payload[1] = static_cast<int>(lengths.size());
+
+    // The datatype picks the ranges right out of the object, so nothing is packed; the object is pinned until
+    // every send is done
+    MPI_Datatype ranges;
+    MPI_Type_create_hindexed(static_cast<int>(lengths.size()), lengths.data(), displacements.data(), MPI_BYTE,
+                             &ranges);
+    MPI_Type_commit(&ranges);
+    const OutgoingData data{objects[var_id].data(), 1, ranges, nullptr, var_id};
+    multicast_locked(subscribers[var_id], OBJECT_WRITE, payload, &data);
+    MPI_Type_free(&ranges); // Sends already posted keep using it
+}
+
+void DSM::send_locked(int destination, int tag, std::vector<int> records) {
+    // The records must outlive the send, so they stay with the request until reap_sends_locked() sees it
+    // done. Synchronous mode: a completed send means the receiver has the message, which flush() relies on.
+    MPI_Request request;
+    MPI_Issend(records.data(), static_cast<int>(records.size()), MPI_INT, destination, tag, comm,
+               &request);
+    ++messages_sent;
+    send_requests.push_back(request);
+    send_holds.push_back(SendHold{std::move(records), nullptr, -1});
+}
+
+void DSM::send_data_locked(int destination, const OutgoingData &data) {
+    MPI_Request request;
+    MPI_Issend(data.base, data.count, data.type, destination, OBJECT_DATA, comm, &request);
+    ++messages_sent;
+    if (data.pinned >= 0) {
+        ++pins[data.pinned];
+    }
+    send_requests.push_back(request);
+    send_holds.push_back(SendHold{{}, data.bytes, data.pinned});
+}
+
+void DSM::release_locked(SendHold &hold) {
+    if (hold.pinned >= 0) {
+        --pins[hold.pinned];
+    }
+    hold = SendHold{};
+}
+
+void DSM::reap_sends_locked() {
+    if (send_requests.empty()) {
+        return;
+    }
+
+    int completed;
+    std::vector<int> indices(send_requests.size());
+    MPI_Testsome(static_cast<int>(send_requests.size()), send_requests.data(), &completed, indices.data(),
+                 MPI_STATUSES_IGNORE);
+
+    // Completed requests are now MPI_REQUEST_NULL: compact both lists around them
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < send_requests.size(); ++i) {
+        if (send_requests[i] != MPI_REQUEST_NULL) {
+            if (kept != i) {
+                send_requests[kept] = send_requests[i];
+                send_holds[kept] = std::move(send_holds[i]);
+            }
+            ++kept;
+        } else {
+            release_locked(send_holds[i]);
+        }
+    }
+    send_requests.resize(kept);
+    send_holds.resize(kept);
+}
+
+void DSM::apply_object_locked(const ObjectUpdate &update, std::vector<Task> &after) {
+    std::vector<std::byte> &object = objects[update.var_id];
+    const std::byte *from = update.data->data();
+    std::size_t first = object.size(), last = 0;
+    for (std::size_t i = 0; i + 1 < update.ranges.size(); i += 2) {
+        const std::size_t offset = update.ranges[i];
+        const std::size_t length = update.ranges[i + 1];
+        std::memcpy(object.data() + offset, from, length);
+        from += length;
+        first = std::min(first, offset);
+        last = std::max(last, offset + length);
+    }
+    assigned[update.var_id] = 1;
+
+    if (object_callback && first < last) {
+        after.push_back([this, name = names[update.var_id], first, last] {
+            executor([this, name, first, last] { object_callback(name, first, last - first, rank); });
+        });
+    }
+}
+
+void DSM::drain_parked_locked(std::vector<Task> &after) {
+    // Later updates of an object stay behind its earlier ones: whatever holds one back holds them all back
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < parked_objects.size(); ++i) {
+        const int var_id = parked_objects[i].var_id;
+        if (var_id < static_cast<int>(names.size()) && !names[var_id].empty() && pins[var_id] == 0) {
+            apply_object_locked(parked_objects[i], after);
+        } else {
+            if (kept != i) {
+                parked_objects[kept] = std::move(parked_objects[i]);
+            }
+            ++kept;
+        }
+    }
+    parked_objects.resize(kept);
+}
+
+void DSM::settle() {
+    std::vector<Task> after;
+    {
+        std::lock_guard lock(mtx);
+        reap_sends_locked();
+        drain_parked_locked(after);
+    }
+    for (Task &task: after) {
+        task();
     }
+}
+
+void DSM::flush() {
+    std::vector<MPI_Request> requests;
+    std::vector<SendHold> holds;
+    {
+        std::lock_guard lock(mtx);
+        requests.swap(send_requests);
+        holds.swap(send_holds);
+    }
+
+    // Not under the lock: completing these needs the other processes' progress threads, and theirs may
+    // be waiting for ours
+    MPI_Waitall(static_cast<int>(requests.size()), requests.data(), MPI_STATUSES_IGNORE);
+
+    std::vector<Task> after;
+    {
+        std::lock_guard lock(mtx);
+        for (SendHold &hold: holds) {
+            release_locked(hold);
+        }
+        drain_parked_locked(after);
+    }
+    for (Task &task: after) {
+        task();
+    }
+}
 
-    if (variables[var_name] == expected) {
-        write(var_name, new_value);
+bool DSM::compare_and_exchange(int var_id, int expected, int new_value) {
+    if (backend == Backend::RMA) {
+        // The window does it atomically; all that is left is our own copy
+        if (!home_swap(var_id, expected, new_value)) {
+            return false;
+        }
+        std::vector<Task> after;
+        {
+            std::lock_guard lock(mtx);
+            apply_locked(var_id, new_value, stamp_locked(), false, after);
+            ++local_writes[var_id];
+        }
+        for (Task &task: after) {
+            task();
+        }
         return true;
     }
-    return false;
+
+    std::future<bool> decided;
+    {
+        std::unique_lock lock(mtx);
+        if (home_of(var_id) == rank) {
+            // We are the home: nothing to ask anybody
+            if (values[var_id] != expected) {
+                return false;
+            }
+            std::vector<Task> after;
+            ordered_write_locked(var_id, new_value, rank, -1, after);
+            lock.unlock();
+            for (Task &task: after) {
+                task();
+            }
+            return true;
+        }
+        decided = ask_home_locked(var_id, CAS_REQUEST, {var_id, expected, new_value});
+    }
+
+    // The progress thread resolves it once the home's answer is in
+    return decided.get();
+}
+
+std::future<bool> DSM::ask_home_locked(int var_id, int tag, std::vector<int> fields) {
+    reap_sends_locked();
+    const int token = next_token++;
+    std::future<bool> answer = pending_decisions[token].get_future();
+    fields.insert(fields.begin(), token);
+    send_locked(home_of(var_id), tag, std::move(fields));
+    return answer;
+}
+
+void DSM::ordered_write_locked(int var_id, int value, int requester, int token, std::vector<Task> &after) {
+    // A fresh stamp from the home is newer than anything it has, so this always applies here
+    apply_locked(var_id, value, stamp_locked(), requester != rank, after);
+
+    // Straight out, even inside a batch: the write is already decided and others must see it. The requester
+    // learns it went through from this very update, which puts it in the same order as everybody else's.
+    reap_sends_locked();
+    const Version &version = versions[var_id];
+    multicast_locked(subscribers[var_id], VALUE_WRITE,
+                     {requester == rank ? -1 : requester, token, var_id, value, version.clock, version.writer});
+}
+
+void DSM::serve_locked(const HomeRequest &request, std::vector<Task> &after) {
+    const int var_id = request.var_id;
+    if (request.tag == READ_REQUEST) {
+        send_locked(request.source, READ_REPLY,
+                    {request.token, var_id, values[var_id], versions[var_id].clock, versions[var_id].writer});
+    } else if (request.tag == ORDERED_WRITE || values[var_id] == request.expected) {
+        ordered_write_locked(var_id, request.value, request.source, request.token, after);
+    } else {
+        send_locked(request.source, CAS_REPLY, {request.token}); // The CAS lost
+    }
+}
+
+bool DSM::compare_and_exchange(const std::string &var_name, int expected, int new_value) {
+    if constexpr (DSM_LOG_LEVEL >= 2) {
+        std::cerr << "Searching for variable: '" << var_name << "'\n";
+        std::lock_guard lock(mtx);
+        for (const auto &name: names) {
+            std::cerr << "Existing variable: '" << name << "'\n";
+        }
+    }
+
+    return compare_and_exchange(subscribe(var_name), expected, new_value);
 }
 
 void DSM::set_callback(const std::function<void(const std::string &, int, int)> &cb) {
+    std::lock_guard lock(mtx);
     callback = cb;
 }
 
-void DSM::listen_for_updates() {
-    MPI_Status status;
-    MPI_Probe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
+void DSM::set_object_callback(
+    const std::function<void(const std::string &, std::size_t, std::size_t, int)> &cb) {
+    std::lock_guard lock(mtx);
+    object_callback = cb;
+}
+
+void DSM::progress_loop(std::stop_token stop) {
+    // Shutdown: {sent, received} summed over everybody, this round and the last
+    MPI_Request reduction = MPI_REQUEST_NULL;
+    long long local_counts[2], total_counts[2], previous_counts[2] = {-1, -1};
+    int idle_rounds = 0;
+
+    while (true) {
+        int flag = 0;
+        MPI_Message message;
+        MPI_Status status;
+        // Matched probe: the message is ours alone, nobody else can receive it in between
+        MPI_Improbe(MPI_ANY_SOURCE, MPI_ANY_TAG, comm, &flag, &message, &status);
+        if (flag) {
+            handle_message(message, status);
+            idle_rounds = 0;
+            continue;
+        }
+
+        // Shutting down: relays may still be passing updates on after their writers are done, so keep serving
+        // until two rounds in a row count the same messages sent as received everywhere. Then nothing is in
+        // flight, and nothing new can start because every application has stopped writing.
+        if (stop.stop_requested()) {
+            int finished = 0;
+            if (reduction == MPI_REQUEST_NULL) {
+                {
+                    std::lock_guard lock(mtx);
+                    local_counts[0] = messages_sent;
+                    local_counts[1] = messages_received;
+                }
+                MPI_Iallreduce(local_counts, total_counts, 2, MPI_LONG_LONG, MPI_SUM, comm, &reduction);
+            } else {
+                MPI_Test(&reduction, &finished, MPI_STATUS_IGNORE);
+            }
+            if (finished) {
+                if (total_counts[0] == total_counts[1] && total_counts[0] == previous_counts[0] &&
+                    total_counts[1] == previous_counts[1]) {
+                    flush(); // All received, so this returns right away
+                    return;
+                }
+                previous_counts[0] = total_counts[0];
+                previous_counts[1] = total_counts[1];
+                continue;
+            }
+        }
+
+        // With RMA, other processes' writes show up in the windows rather than as messages
+        if (backend == Backend::RMA && poll_windows()) {
+            idle_rounds = 0;
+            continue;
+        }
+
+        // Object updates held back for one of our sends can go in once it is done
+        settle();
+
+        // Nothing arrived: spin a little, then back off so the application keeps the core
+        if (++idle_rounds < SPIN_ROUNDS) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(IDLE_SLEEP);
+        }
+    }
+}
+
+void DSM::handle_message(MPI_Message &message, MPI_Status &status) {
+    const int source = status.MPI_SOURCE;
+    std::vector<Task> after;
+
+    if (status.MPI_TAG == INTERN) {
+        int count;
+        MPI_Get_count(&status, MPI_INT, &count);
+        std::vector<int> request(count);
+        MPI_Mrecv(request.data(), count, MPI_INT, &message, MPI_STATUS_IGNORE);
+
+        // Somebody else may have asked for the same name first; then everybody already has its id
+        intern(std::string(request.begin() + 1, request.end()), request[0]);
+    } else if (status.MPI_TAG == SUBSCRIBE || status.MPI_TAG == VALUE_WRITE) {
+        int count;
+        MPI_Get_count(&status, MPI_INT, &count);
+        std::vector<int> message_ints(count);
+        MPI_Mrecv(message_ints.data(), count, MPI_INT, &message, MPI_STATUS_IGNORE);
+
+        // Pass it on to our part of the multicast tree first, then take what is left for ourselves
+        const int *relays = message_ints.data() + 1;
+        const int *payload = relays + message_ints[0];
+        const int *end = message_ints.data() + count;
+
+        std::lock_guard lock(mtx);
+        ++messages_received;
+        relay_locked(relays, payload, status.MPI_TAG, std::vector<int>(payload, end));
 
-    if (status.MPI_TAG == SUBSCRIBE) {
-        int var_name_length;
-        MPI_Get_count(&status, MPI_CHAR, &var_name_length);
-        char var_name_cstr[var_name_length + 1];
+        if (status.MPI_TAG == SUBSCRIBE) {
+            // Add the subscriber to the list of subscribers
+            bind_locked(payload[0], std::string(payload + 2, end), payload[1], after);
+            bound_cv.notify_all();
+        } else {
+            // A whole batch: apply every update in order and call the callback for each. If the home sent it for
+            // our own CAS or ordered write, it is our write (no callback) and the request went through.
+            const bool ours = payload[0] == rank;
+            for (const int *record = payload + 2; record + 3 < end; record += 4) {
+                const Update update{record[0], record[1], Version{record[2], record[3]}};
+                if (update.var_id >= static_cast<int>(names.size()) || names[update.var_id].empty()) {
+                    unbound_updates.push_back(update); // Its announcement from rank 0 is still on the way
+                    continue;
+                }
 
-        MPI_Recv(var_name_cstr, var_name_length, MPI_CHAR, status.MPI_SOURCE, SUBSCRIBE, MPI_COMM_WORLD, &status);
-        var_name_cstr[var_name_length] = '\0'; // Ensure null-termination
-        std::string var_name(var_name_cstr, var_name_length);
+                // update the local copy (unless it has something newer), then call the callback
+                apply_locked(update.var_id, update.value, update.version, !ours, after);
+            }
+            if (ours) {
+                auto promise = std::make_shared<std::promise<bool>>(std::move(pending_decisions.at(payload[1])));
+                pending_decisions.erase(payload[1]);
+                after.push_back([promise] { promise->set_value(true); });
+            }
+        }
+    } else if (status.MPI_TAG == OBJECT_WRITE) {
+        int count;
+        MPI_Get_count(&status, MPI_INT, &count);
+        std::vector<int> message_ints(count);
+        MPI_Mrecv(message_ints.data(), count, MPI_INT, &message, MPI_STATUS_IGNORE);
+        const int *relays = message_ints.data() + 1;
+        const int *payload = relays + message_ints[0];
+        const int *end = message_ints.data() + count;
 
-        // Add the subscriber to the list of subscribers
-        subscribe(var_name, false);
-    } else if (status.MPI_TAG == VALUE_WRITE) {
-        int var_name_length;
-        MPI_Get_count(&status, MPI_CHAR, &var_name_length);
-        char var_name_cstr[var_name_length + 1];
+        ObjectUpdate update{payload[0], std::vector<int>(payload + 2, end), nullptr};
+        int bytes = 0;
+        for (std::size_t i = 1; i < update.ranges.size(); i += 2) {
+            bytes += update.ranges[i];
+        }
+        // The sender posted the data right behind the header, so this does not wait on anything but the wire
+        update.data = std::make_shared<std::vector<std::byte>>(bytes);
+        MPI_Recv(update.data->data(), bytes, MPI_BYTE, source, OBJECT_DATA, comm, MPI_STATUS_IGNORE);
 
-        // First, we receive the variable name
-        MPI_Recv(var_name_cstr, var_name_length, MPI_CHAR, status.MPI_SOURCE, VALUE_WRITE, MPI_COMM_WORLD, &status);
-        var_name_cstr[var_name_length] = '\0'; // Ensure null-termination
-        std::string var_name(var_name_cstr, var_name_length);
+        // Relays forward the very buffer we received into
+        std::lock_guard lock(mtx);
+        messages_received += 2;
+        const OutgoingData data{update.data->data(), bytes, MPI_BYTE, update.data, -1};
+        relay_locked(relays, payload, OBJECT_WRITE, std::vector<int>(payload, end), &data);
+        parked_objects.push_back(std::move(update));
+        drain_parked_locked(after);
+    } else if (status.MPI_TAG == CAS_REQUEST || status.MPI_TAG == ORDERED_WRITE || status.MPI_TAG == READ_REQUEST) {
+        int count;
+        MPI_Get_count(&status, MPI_INT, &count);
+        int fields[4] = {};
+        MPI_Mrecv(fields, count, MPI_INT, &message, MPI_STATUS_IGNORE);
+        HomeRequest request{status.MPI_TAG, source, fields[0], fields[1], 0, fields[2]};
+        if (status.MPI_TAG == CAS_REQUEST) {
+            request.expected = fields[2];
+            request.value = fields[3];
+        }
 
-        // Then, we receive the value
-        int value;
-        MPI_Recv(&value, 1, MPI_INT, status.MPI_SOURCE, VALUE_WRITE, MPI_COMM_WORLD, &status);
+        std::lock_guard lock(mtx);
+        ++messages_received;
+        if (request.var_id >= static_cast<int>(names.size()) || names[request.var_id].empty()) {
+            unbound_requests.push_back(request); // Served once rank 0's announcement reaches us
+        } else {
+            serve_locked(request, after);
+        }
+    } else if (status.MPI_TAG == CAS_REPLY) {
+        int token;
+        MPI_Mrecv(&token, 1, MPI_INT, &message, MPI_STATUS_IGNORE);
 
-        // then we update the local copy
-        variables[var_name] = value;
+        // Only lost races get a reply
+        std::lock_guard lock(mtx);
+        ++messages_received;
+        auto promise = std::make_shared<std::promise<bool>>(std::move(pending_decisions.at(token)));
+        pending_decisions.erase(token);
+        after.push_back([promise] { promise->set_value(false); });
+    } else if (status.MPI_TAG == READ_REPLY) {
+        int fields[5];
+        MPI_Mrecv(fields, 5, MPI_INT, &message, MPI_STATUS_IGNORE);
+        const int value = fields[2];
 
-        // finally, we call the callback
-        callback(var_name, value, rank);
+        // The home's value is the answer; our copy takes it too if it is newer than what we have
+        std::lock_guard lock(mtx);
+        ++messages_received;
+        apply_locked(fields[1], value, Version{fields[3], fields[4]}, true, after);
+        auto promise = std::make_shared<std::promise<int>>(std::move(pending_reads.at(fields[0])));
+        pending_reads.erase(fields[0]);
+        after.push_back([promise, value] { promise->set_value(value); });
     } else {
-        std::cout << "Unknown message type" << std::endl;
+        if constexpr (DSM_LOG_LEVEL >= 1) {
+            std::cerr << "Unknown message type from " << source << std::endl;
+        }
+        int bytes;
+        MPI_Get_count(&status, MPI_BYTE, &bytes);
+        std::vector<char> sink(bytes);
+        MPI_Mrecv(sink.data(), bytes, MPI_BYTE, &message, MPI_STATUS_IGNORE);
+    }
+
+    for (Task &task: after) {
+        task();
     }
 }
@@ -1,33 +1,291 @@
 #pragma once
-#include <map>
-#include <vector>
-#include <string>
+#include <mpi.h>
+#include <condition_variable>
+#include <cstddef>
 #include <functional>
-#include <set>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+inline int INITIALIZED = -1;  // What an int nobody wrote yet reads as; has_value() tells it from a written -1
 
-inline int INITIALIZED = -1;
+// How much the DSM prints: 0 nothing, 1 errors, 2 also every construction, write and name lookup. Whatever is above
+// the level is compiled out; pick another one with -DDSM_LOG_LEVEL=n.
+#ifndef DSM_LOG_LEVEL
+#ifdef NDEBUG
+#define DSM_LOG_LEVEL 1
+#else
+#define DSM_LOG_LEVEL 2
+#endif
+#endif
 
+// SUBSCRIBE, VALUE_WRITE and OBJECT_WRITE are multicast: they start with {n, the n ranks this receiver relays to}
 enum MessageType {
-    SUBSCRIBE = 100,
-    VALUE_WRITE = 101
+    SUBSCRIBE = 100,  // Rank 0 -> everybody: the id a variable name was given (id, bytes, then the name one char per int)
+    VALUE_WRITE = 101,  // {requester or -1, its token} then {id, value, stamp clock, stamp writer}, one per update
+    INTERN = 102,  // Anybody -> rank 0: please give this name an id ({bytes, then the name one char per int})
+    CAS_REQUEST = 103,  // Anybody -> a variable's home: {token, id, expected, new value}
+    CAS_REPLY = 104,  // Home -> requester: {token} of a CAS that lost; one that won comes back as its VALUE_WRITE
+    OBJECT_WRITE = 105,  // {id, n, then n (offset, length) ranges}; its OBJECT_DATA follows right behind
+    OBJECT_DATA = 106,  // The bytes of those ranges, back to back
+    ORDERED_WRITE = 107,  // Anybody -> a variable's home: {token, id, value}; comes back as its VALUE_WRITE
+    READ_REQUEST = 108,  // Anybody -> a variable's home: {token, id}
+    READ_REPLY = 109  // Home -> requester: {token, id, value, stamp clock, stamp writer}
 };
 
+/**
+ * Distributed shared memory of named ints and objects. Every process subscribes to the variables it
+ * uses; writes reach the other subscribers, and callbacks or when() futures tell the application about
+ * them. Incoming messages are handled by a progress thread the DSM owns, so MPI must be initialised with
+ * MPI_THREAD_MULTIPLE. The DSM talks over its own duplicate of MPI_COMM_WORLD, leaving the application's
+ * messages alone.
+ */
 class DSM {
 public:
-    DSM(int rank, int size);
+    using Task = std::function<void()>;
+    using Executor = std::function<void(Task)>;
+
+    // With RMA, processes on the home's node store to its slot directly through an MPI_Win_allocate_shared
+    // segment and everybody else uses MPI atomics on it. The progress thread polls the slots for other
+    // processes' changes, so a value overwritten before the next poll is never seen by callbacks. Names are
+    // still interned and objects still sent over messages, so an object update and an int write are not
+    // ordered with each other: readers of an object flagged by an int should wait for the object callback.
+    // The windows hold a fixed number of variables.
+    enum class Backend {
+        MESSAGES,  // Every process keeps a copy; writes are sent to the subscribers
+        RMA  // One copy per variable in its home's window; writes are stores into it
+    };
+
+    // Int updates carry a Lamport stamp (clock, writer) and a copy only moves to a newer one, so all copies
+    // settle on the same last write. With RMA the home's slot is the order: RELAXED reads the copy the
+    // progress thread polled, the others the slot. Objects are not stamped: spans apply in arrival order.
+    enum class Consistency {
+        RELAXED,  // Our copy, whatever it is right now
+        MONOTONIC,  // Never older than anything we read or wrote before
+        SEQUENTIAL  // One order for the variable, kept by its home
+    };
+
+    // Collective: every process constructs its DSM together (needed for the RMA windows). Callbacks go
+    // through `executor`; by default they run right on the progress thread.
+    DSM(int rank, int size, Executor executor = {}, Backend backend = Backend::MESSAGES, int rma_capacity = 4096);
+    ~DSM();  // Collective: every process must destroy its DSM, and no update is lost on the way out
+
+    DSM(const DSM&) = delete;
+    DSM& operator=(const DSM&) = delete;
 
-    void subscribe(const std::string& var_name, bool broadcast = true);  // Subscribe to variable (local and propagate)
-    void broadcast_subscription(const std::string& var_name);  // Send subscriptions to all other processes
-    void write(const std::string& var_name, int value);
+    static constexpr std::size_t CHUNK = 4096;  // An object's dirty tracking keeps one span per chunk
+
+    // Rank 0 hands out a dense id per name and announces it to everybody; the string overloads below look
+    // it up each time, so hot loops should keep the id
+    int subscribe(const std::string& var_name);  // Subscribe to variable everywhere, returns its id
+    // An object of a fixed number of bytes. Only the spans written since a chunk was last sent go out, straight
+    // from our copy; until that send is done our writes to the object wait and updates from others are held
+    // back. Objects always travel as messages and have no CAS or when().
+    int share(const std::string& var_name, std::size_t bytes);
+    template <class T>
+    int share(const std::string& var_name, std::size_t count = 1) {
+        static_assert(std::is_trivially_copyable_v<T>, "Only plain data can be shared");
+        return share(var_name, count * sizeof(T));
+    }
+    int id_of(const std::string& var_name) const;  // -1 if nobody subscribed to it yet (as far as we know)
+    bool has_value(int var_id) const;  // Somebody wrote it already
+    std::size_t size_of(int var_id) const;  // Bytes of an object, 0 for an int
+
+    void write(int var_id, int value, Consistency level = Consistency::RELAXED);
+    void write(const std::string& var_name, int value, Consistency level = Consistency::RELAXED);
+    int read(int var_id, Consistency level = Consistency::RELAXED);
+    int read(const std::string& var_name, Consistency level = Consistency::RELAXED);
+
+    // Objects: byte ranges, or element `index` of an array of T
+    void write_bytes(int var_id, std::size_t offset, const void* data, std::size_t length);
+    void read_bytes(int var_id, std::size_t offset, void* out, std::size_t length) const;
+    template <class T>
+    void store(int var_id, const T& value, std::size_t index = 0) {
+        write_bytes(var_id, index * sizeof(T), &value, sizeof(T));
+    }
+    template <class T>
+    void store(int var_id, const T* first, std::size_t count, std::size_t index = 0) {
+        write_bytes(var_id, index * sizeof(T), first, count * sizeof(T));
+    }
+    template <class T>
+    T load(int var_id, std::size_t index = 0) const {
+        T value;
+        read_bytes(var_id, index * sizeof(T), &value, sizeof(T));
+        return value;
+    }
+
+    // Resolves with the value as soon as `condition` holds for it (right away if it already does)
+    std::future<int> when(int var_id, std::function<bool(int)> condition);
+    std::future<int> when(const std::string& var_name, std::function<bool(int)> condition);
+
+    // Writes between begin_batch() and commit() are applied locally right away but only sent on commit():
+    // repeated writes to the same variable collapse into the last one, and every subscriber gets a single
+    // message with all of its updates. Batches nest; only the outermost commit() sends. With Backend::RMA the
+    // ints of a batch are stored without waiting for its objects, so they can be seen first.
+    void begin_batch();
+    void commit();
+    void flush();  // Wait until every update sent so far has reached its first hop (relays pass it on from there)
+
+    // CAS is decided under the home's lock and is linearizable against every other CAS of the variable; a plain
+    // write() is only ordered against them where the home receives it, so leases and counters should use CAS
+    int home_of(int var_id) const { return var_id % size; }
+    bool compare_and_exchange(int var_id, int expected, int new_value);  // Blocks until the home decided
     bool compare_and_exchange(const std::string& var_name, int expected, int new_value);
     void set_callback(const std::function<void(const std::string&, int, int)>& cb);
-    void listen_for_updates();
+    // Objects: called with the name, the span [offset, offset + length) an update covered, and our rank
+    void set_object_callback(const std::function<void(const std::string&, std::size_t, std::size_t, int)>& cb);
 
 private:
+    struct Waiter {
+        std::function<bool(int)> condition;
+        std::promise<int> promise;
+    };
+
+    // Lamport stamp of an int update: ties between clocks go to the higher rank
+    struct Version {
+        int clock = 0;
+        int writer = -1;
+        auto operator<=>(const Version&) const = default;
+    };
+
+    struct Update {
+        int var_id;
+        int value;
+        Version version;
+    };
+
+    // A CAS_REQUEST, ORDERED_WRITE or READ_REQUEST for the home to serve
+    struct HomeRequest {
+        int tag;
+        int source;
+        int token;
+        int var_id;
+        int expected;
+        int value;
+    };
+
+    struct ObjectUpdate {
+        int var_id;
+        std::vector<int> ranges;  // (offset, length) pairs
+        std::shared_ptr<std::vector<std::byte>> data;  // The ranges' bytes, back to back
+    };
+
+    // Keeps what an in-flight send reads from alive, or our object untouched
+    struct SendHold {
+        std::vector<int> ints;
+        std::shared_ptr<std::vector<std::byte>> bytes;
+        int pinned = -1;  // The object it reads straight out of
+    };
+
+    // The OBJECT_DATA that goes with an OBJECT_WRITE
+    struct OutgoingData {
+        const void* base;
+        int count;
+        MPI_Datatype type;
+        std::shared_ptr<std::vector<std::byte>> bytes;
+        int pinned;
+    };
+
     int rank;  // Current process rank
     int size;  // Total number of processes
-    std::map<std::string, int> variables;  // Local variables
-    std::map<std::string, std::set<int>> subscribers;  // Subscribers for each variable
+    MPI_Comm comm = MPI_COMM_NULL;  // Our own duplicate of MPI_COMM_WORLD, so the application's messages never meet ours
     std::vector<int> other_processes;  // Other processes in the MPI_COMM_WORLD
+    std::vector<int> node_of;  // By world rank: the lowest world rank on the same node
     std::function<void(const std::string&, int, int)> callback;
-};
\ No newline at end of file
+    std::function<void(const std::string&, std::size_t, std::size_t, int)> object_callback;
+    Executor executor;
+
+    // RMA backend only. Variable id lives in slot id / size of its home's segment.
+    Backend backend;
+    int rma_capacity;  // Variables the windows have room for
+    int rma_slots = 0;  // Slots in every process' segment
+    MPI_Comm node_comm = MPI_COMM_NULL;  // The processes sharing our node's memory
+    MPI_Win node_win = MPI_WIN_NULL;  // The node's segments, allocated together
+    MPI_Win world_win = MPI_WIN_NULL;  // The same memory, open to every process
+    std::vector<int*> shared_segments;  // By world rank: its segment if it is on our node, else nullptr
+
+    // Everything below is shared with the progress thread
+    mutable std::mutex mtx;
+    std::condition_variable bound_cv;  // A new name -> id binding arrived
+
+    // Indexed by variable id
+    std::vector<std::string> names;
+    std::vector<int> values;
+    std::vector<Version> versions;  // Of the value we have
+    std::vector<std::vector<int>> subscribers;  // Subscribers for each variable
+    std::vector<std::vector<Waiter>> waiters;  // Pending when() calls
+    std::vector<unsigned> local_writes;  // RMA: bumped by each of our writes, so a slower poll cannot undo it
+    std::vector<char> assigned;  // Written by anybody yet
+    std::vector<std::vector<std::byte>> objects;  // Empty for ints
+    std::vector<std::vector<std::pair<int, int>>> dirty_spans;  // Per object chunk: [first, last) byte written, if any
+    std::vector<int> pins;  // Sends in flight that read straight out of the object
+    std::unordered_map<std::string, int> ids;  // Only consulted by the string overloads
+    int next_id = 0;  // Rank 0 only: the id the next new name gets
+    std::vector<Update> unbound_updates;  // Received before the id's announcement (it comes from another process)
+    std::vector<ObjectUpdate> parked_objects;  // Received before the announcement, or while the object is pinned
+
+    int batch_depth = 0;
+    std::vector<int> dirty_ids;  // Written in the open batch; the value sent is whatever is latest at commit()
+    std::vector<char> dirty;  // Per id: already in dirty_ids
+
+    int lamport = 0;  // Highest clock we stamped or saw
+    int next_token = 0;
+    std::unordered_map<int, std::promise<bool>> pending_decisions;  // Our CASes and ordered writes, by token
+    std::unordered_map<int, std::promise<int>> pending_reads;  // Our SEQUENTIAL reads, by token
+    std::vector<HomeRequest> unbound_requests;  // Home only: for ids whose announcement is still on the way
+
+    // Sends still in flight and what they read from (same index)
+    std::vector<MPI_Request> send_requests;
+    std::vector<SendHold> send_holds;
+    long long messages_sent = 0;  // Counted for the shutdown: everything but INTERN
+    long long messages_received = 0;
+
+    std::jthread progress;  // Last member: it must stop before anything it touches goes away
+
+    // Helpers marked "locked" expect mtx to be held; they queue what must run after unlocking into `after`
+    int intern(const std::string& var_name, std::size_t bytes);
+    void bind_locked(int var_id, const std::string& var_name, std::size_t bytes, std::vector<Task>& after);
+    Version stamp_locked() { return Version{++lamport, rank}; }
+    // False, and nothing happens, if our copy is already newer
+    bool apply_locked(int var_id, int value, Version version, bool remote, std::vector<Task>& after);
+    void send_updates_locked();
+    void send_object_locked(int var_id);  // The dirty chunks, straight out of our copy
+    // Home only: stamp, apply and multicast a write on behalf of `requester`
+    void ordered_write_locked(int var_id, int value, int requester, int token, std::vector<Task>& after);
+    void serve_locked(const HomeRequest& request, std::vector<Task>& after);
+    // Sends {token, fields...} to the variable's home; resolved by the progress thread
+    std::future<bool> ask_home_locked(int var_id, int tag, std::vector<int> fields);
+    void send_locked(int destination, int tag, std::vector<int> records);  // Issend, tracked for flush()
+    void send_data_locked(int destination, const OutgoingData& data);
+    // Binomial tree over the destinations: we send log2(P) messages and every receiver relays to its share.
+    // The tree only depends on the writer and the destinations, so one writer's updates stay in order.
+    void multicast_locked(std::vector<int> destinations, int tag, const std::vector<int>& payload,
+                          const OutgoingData* data = nullptr);
+    void relay_locked(const int* first, const int* last, int tag, const std::vector<int>& payload,
+                      const OutgoingData* data = nullptr);
+    void release_locked(SendHold& hold);
+    void reap_sends_locked();  // Drop the buffers of sends that have completed
+    void apply_object_locked(const ObjectUpdate& update, std::vector<Task>& after);
+    void drain_parked_locked(std::vector<Task>& after);  // Apply held-back object updates that can go in now
+    void settle();  // Reap, then drain
+    void announce(int var_id, const std::string& var_name, std::size_t bytes);  // Rank 0: tell everybody
+
+    void find_nodes();
+    void setup_windows();
+    void free_windows();
+    int slot_of(int var_id) const { return var_id / size; }
+    int slot_load(int var_id) const;  // Straight from the home's slot
+    void slot_store(int var_id, int value);
+    bool home_swap(int var_id, int expected, int new_value);
+    bool poll_windows();  // Apply what other processes stored since the last poll; true if anything changed
+
+    void progress_loop(std::stop_token stop);
+    void handle_message(MPI_Message& message, MPI_Status& status);
+};
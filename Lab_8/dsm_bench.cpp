@@ -0,0 +1,308 @@
+#include <mpi.h>
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "dsm.h"
+
+// DSM micro-benchmarks, each run for a sweep of variable counts:
+//   write:   rank 0 writes round-robin over the variables, everybody subscribed; throughput is until the last
+//            rank has the final write, the histogram is the cost of one write() call on rank 0
+//   latency: rank 0 writes a ping variable, the callback on the last rank writes it back; half of the round
+//            trip is the time from write() to the other side's callback
+//   cas:     every rank increments counter (rank % variables) with compare-and-exchange; the fewer the
+//            variables, the more ranks fight over each counter. Retries are counted, lost increments checked.
+// The rank count is whatever mpirun was given; the dsm_bench_sweep target runs it for several.
+//
+// Usage: mpirun -np <P> dsm_bench [iterations] [messages|rma] [results.csv]
+// One CSV row per benchmark and variable count goes to stdout, or is appended to results.csv.
+
+using Clock = std::chrono::steady_clock;
+
+static const std::vector<int> VARIABLE_COUNTS = {1, 16, 256};
+
+// Log-linear latency histogram in nanoseconds: exact below 32, then 32 buckets per power of two (~3% error).
+// Fixed size, so ranks can add theirs up with a plain MPI_Reduce.
+class Histogram {
+public:
+    static constexpr int SUB_BITS = 5;
+    static constexpr int SUB_BUCKETS = 1 << SUB_BITS;
+    static constexpr int BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+    void record(Clock::duration elapsed) {
+        const auto nanos = static_cast<std::uint64_t>(std::max<std::int64_t>(
+            0, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+        ++counts[index_of(nanos)];
+        max_nanos = std::max(max_nanos, nanos);
+    }
+
+    // Adds everybody's histogram up on rank 0
+    void reduce() {
+        std::array<std::uint64_t, BUCKETS> total{};
+        std::uint64_t max_total = 0;
+        MPI_Reduce(counts.data(), total.data(), BUCKETS, MPI_UINT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
+        MPI_Reduce(&max_nanos, &max_total, 1, MPI_UINT64_T, MPI_MAX, 0, MPI_COMM_WORLD);
+        counts = total;
+        max_nanos = max_total;
+    }
+
+    std::uint64_t total() const {
+        std::uint64_t sum = 0;
+        for (std::uint64_t count: counts) {
+            sum += count;
+        }
+        return sum;
+    }
+
+    // The middle of the bucket the q-th quantile falls into, in microseconds
+    double quantile_us(double q) const {
+        const std::uint64_t wanted = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(q * total() + 0.999999));
+        std::uint64_t seen = 0;
+        for (int i = 0; i < BUCKETS; ++i) {
+            seen += counts[i];
+            if (seen >= wanted) {
+                const std::uint64_t low = lower_bound_of(i);
+                const std::uint64_t width = lower_bound_of(i + 1) - low;
+                return std::min<double>(static_cast<double>(low) + static_cast<double>(width) / 2,
+                                        static_cast<double>(max_nanos)) / 1000.0;
+            }
+        }
+        return 0;
+    }
+
+    double max_us() const {
+        return static_cast<double>(max_nanos) / 1000.0;
+    }
+
+private:
+    static int index_of(std::uint64_t nanos) {
+        if (nanos < SUB_BUCKETS) {
+            return static_cast<int>(nanos);
+        }
+        const int exponent = std::bit_width(nanos) - 1;
+        const int sub = static_cast<int>((nanos >> (exponent - SUB_BITS)) & (SUB_BUCKETS - 1));
+        return (exponent - SUB_BITS + 1) * SUB_BUCKETS + sub;
+    }
+
+    static std::uint64_t lower_bound_of(int index) {
+        if (index < SUB_BUCKETS) {
+            return index;
+        }
+        const int exponent = index / SUB_BUCKETS + SUB_BITS - 1;
+        return static_cast<std::uint64_t>(SUB_BUCKETS + index % SUB_BUCKETS) << (exponent - SUB_BITS);
+    }
+
+    std::array<std::uint64_t, BUCKETS> counts{};
+    std::uint64_t max_nanos = 0;
+};
+
+struct Result {
+    std::string benchmark;
+    int variables;
+    std::uint64_t operations;
+    double seconds;
+    std::uint64_t retries;
+    const Histogram &histogram;
+};
+
+static std::string csv_header() {
+    return "benchmark,backend,ranks,variables,operations,seconds,ops_per_second,p50_us,p99_us,p999_us,max_us,retries";
+}
+
+static std::string csv_row(const Result &result, const std::string &backend, int size) {
+    std::ostringstream row;
+    row << result.benchmark << ',' << backend << ',' << size << ',' << result.variables << ',' << result.operations
+            << ',' << result.seconds << ',' << static_cast<double>(result.operations) / result.seconds << ','
+            << result.histogram.quantile_us(0.50) << ',' << result.histogram.quantile_us(0.99) << ','
+            << result.histogram.quantile_us(0.999) << ',' << result.histogram.max_us() << ',' << result.retries;
+    return row.str();
+}
+
+static double seconds_since(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static std::vector<int> subscribe_all(DSM &dsm, const std::string &prefix, int count) {
+    std::vector<int> ids;
+    for (int i = 0; i < count; ++i) {
+        ids.push_back(dsm.subscribe(prefix + std::to_string(i)));
+    }
+    return ids;
+}
+
+int main(int argc, char **argv) {
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &provided);
+
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    if (provided < MPI_THREAD_MULTIPLE || size < 2) {
+        if (rank == 0) {
+            std::cerr << "Needs MPI_THREAD_MULTIPLE and at least 2 processes" << std::endl;
+        }
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    // Every rank parses the same arguments, so they all agree on giving up
+    int iterations = 10000;
+    const std::string iterations_arg = argc > 1 ? argv[1] : "10000";
+    const auto [end, error] = std::from_chars(iterations_arg.data(), iterations_arg.data() + iterations_arg.size(),
+                                              iterations);
+    const std::string backend_name = argc > 2 ? argv[2] : "messages";
+    if (error != std::errc() || end != iterations_arg.data() + iterations_arg.size() || iterations < 1 ||
+        (backend_name != "messages" && backend_name != "rma")) {
+        if (rank == 0) {
+            std::cerr << "Usage: mpirun -np <P> dsm_bench [iterations >= 1] [messages|rma] [results.csv]" << std::endl;
+        }
+        MPI_Finalize();
+        return 1;
+    }
+    const DSM::Backend backend = backend_name == "rma" ? DSM::Backend::RMA : DSM::Backend::MESSAGES;
+    const std::string output = argc > 3 ? argv[3] : "";
+
+    std::vector<std::string> rows;
+    {
+        DSM dsm(rank, size, {}, backend);
+
+        // Everything is subscribed up front, so the id round trips to rank 0 stay out of the timings
+        std::vector<std::vector<int>> written, pings, counters;
+        for (int variables: VARIABLE_COUNTS) {
+            const std::string suffix = std::to_string(variables) + "_";
+            written.push_back(subscribe_all(dsm, "write" + suffix, variables));
+            pings.push_back(subscribe_all(dsm, "ping" + suffix, variables));
+            counters.push_back(subscribe_all(dsm, "counter" + suffix, variables));
+        }
+        const int pong = dsm.subscribe("pong");
+
+        // The far end of the ping-pong answers from its callback, so the time includes getting there
+        if (rank == size - 1) {
+            dsm.set_callback([&dsm, pong](const std::string &var_name, int value, int) {
+                if (var_name.starts_with("ping")) {
+                    dsm.write(pong, value);
+                }
+            });
+        }
+        MPI_Barrier(MPI_COMM_WORLD);
+
+        int sequence = 0; // Every ping carries a value never seen before
+        for (std::size_t sweep = 0; sweep < VARIABLE_COUNTS.size(); ++sweep) {
+            const int variables = VARIABLE_COUNTS[sweep];
+
+            // Write throughput
+            {
+                Histogram histogram;
+                const int last_id = written[sweep][(iterations - 1) % variables];
+                const int last_value = iterations - 1;
+                MPI_Barrier(MPI_COMM_WORLD);
+                const auto start = Clock::now();
+                if (rank == 0) {
+                    for (int i = 0; i < iterations; ++i) {
+                        const auto issued = Clock::now();
+                        dsm.write(written[sweep][i % variables], i);
+                        histogram.record(Clock::now() - issued);
+                    }
+                    dsm.flush();
+                }
+                // Updates from one writer arrive in order, so the last one means all of them are in
+                dsm.when(last_id, [last_value](int value) { return value == last_value; }).wait();
+                MPI_Barrier(MPI_COMM_WORLD);
+                const double seconds = seconds_since(start);
+                if (rank == 0) {
+                    rows.push_back(csv_row({"write", variables, static_cast<std::uint64_t>(iterations), seconds, 0,
+                                            histogram}, backend_name, size));
+                }
+            }
+
+            // Write to callback latency
+            {
+                Histogram histogram;
+                const int rounds = std::max(1, iterations / 10);
+                MPI_Barrier(MPI_COMM_WORLD);
+                const auto start = Clock::now();
+                if (rank == 0) {
+                    for (int i = 0; i < rounds; ++i) {
+                        const int value = ++sequence;
+                        const auto sent = Clock::now();
+                        dsm.write(pings[sweep][i % variables], value);
+                        dsm.when(pong, [value](int answer) { return answer == value; }).wait();
+                        histogram.record((Clock::now() - sent) / 2);
+                    }
+                }
+                MPI_Barrier(MPI_COMM_WORLD);
+                const double seconds = seconds_since(start);
+                if (rank == 0) {
+                    rows.push_back(csv_row({"latency", variables, static_cast<std::uint64_t>(rounds), seconds, 0,
+                                            histogram}, backend_name, size));
+                }
+                MPI_Bcast(&sequence, 1, MPI_INT, 0, MPI_COMM_WORLD);
+            }
+
+            // Contended compare-and-exchange
+            {
+                Histogram histogram;
+                std::uint64_t retries = 0;
+                const int rounds = std::max(1, iterations / 10);
+                const int counter = counters[sweep][rank % variables];
+                MPI_Barrier(MPI_COMM_WORLD);
+                const auto start = Clock::now();
+                for (int i = 0; i < rounds; ++i) {
+                    const auto began = Clock::now();
+                    int current = dsm.read(counter, DSM::Consistency::MONOTONIC);
+                    while (!dsm.compare_and_exchange(counter, current, current + 1)) {
+                        ++retries;
+                        current = dsm.read(counter, DSM::Consistency::MONOTONIC);
+                    }
+                    histogram.record(Clock::now() - began);
+                }
+                MPI_Barrier(MPI_COMM_WORLD);
+                const double seconds = seconds_since(start);
+
+                // Not timed: every increment of our counter must have made it
+                const int sharing = size / variables + (rank % variables < size % variables ? 1 : 0);
+                const int expected_total = INITIALIZED + sharing * rounds;
+                dsm.when(counter, [expected_total](int value) { return value == expected_total; }).wait();
+
+                histogram.reduce();
+                std::uint64_t total_retries = 0;
+                MPI_Reduce(&retries, &total_retries, 1, MPI_UINT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
+                if (rank == 0) {
+                    rows.push_back(csv_row({"cas", variables, histogram.total(), seconds, total_retries, histogram},
+                                           backend_name, size));
+                }
+            }
+        }
+        MPI_Barrier(MPI_COMM_WORLD);
+    }
+
+    if (rank == 0) {
+        if (output.empty()) {
+            std::cout << csv_header() << '\n';
+            for (const std::string &row: rows) {
+                std::cout << row << '\n';
+            }
+        } else {
+            // Appending lets one file collect a whole sweep; only the first run writes the header
+            const bool fresh = !std::ifstream(output).good();
+            std::ofstream file(output, std::ios::app);
+            if (fresh) {
+                file << csv_header() << '\n';
+            }
+            for (const std::string &row: rows) {
+                file << row << '\n';
+            }
+        }
+    }
+
+    MPI_Finalize();
+    return 0;
+}
@@ -1,6 +1,7 @@
 #include <mpi.h>
+#include <future>
 #include <iostream>
-#include <thread>
+#include <string>
 
 #include "dsm.h"
 
@@ -8,39 +9,77 @@ void on_variable_change(const std::string& var_name, int value, int rank) {
     std::cout << "Variable " << var_name << " changed to " << value << " in node rank of " << rank << std::endl;
 }
 
+void on_object_change(const std::string& var_name, std::size_t offset, std::size_t length, int rank) {
+    std::cout << "Object " << var_name << " bytes [" << offset << ", " << offset + length << ") changed in node rank of "
+            << rank << std::endl;
+}
+
 int main(int argc, char** argv) {
-    MPI_Init(&argc, &argv);
+    // The DSM's progress thread calls MPI alongside ours
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &provided);
 
     int rank, size;
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
 
-    // Create Distributed Shared Memory instance
-    DSM dsm(rank, size);
+    if (provided < MPI_THREAD_MULTIPLE) {
+        if (rank == 0) {
+            std::cerr << "The MPI library does not support MPI_THREAD_MULTIPLE" << std::endl;
+        }
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    // `Lab_8 rma` keeps the variables in MPI windows instead of sending every write around
+    const DSM::Backend backend = argc > 1 && std::string(argv[1]) == "rma" ? DSM::Backend::RMA : DSM::Backend::MESSAGES;
 
-    // Set callback for when a variable changes
-    dsm.set_callback(on_variable_change);
+    {
+        // Set by the object callback once process 0's elements of the array arrived (it writes them only once)
+        std::promise<void> weights_arrived;
 
-    if (rank == 0) {
-        // Subscribe to variables
-        dsm.subscribe("var1");
-        dsm.subscribe("var2");
+        // Create Distributed Shared Memory instance
+        DSM dsm(rank, size, {}, backend);
 
-        std::cout << "Process 0 writing to var1 and var2" << std::endl;
-        dsm.write("var1", 42);  // Process 0 writes to var1
-        dsm.compare_and_exchange("var2", INITIALIZED, 100);  // If var2 == 0, set it to 100
-    }
+        // Set callback for when a variable changes
+        dsm.set_callback(on_variable_change);
+        dsm.set_object_callback([&](const std::string& var_name, std::size_t offset, std::size_t length, int node) {
+            on_object_change(var_name, offset, length, node);
+            if (var_name == "weights" && offset <= 1000 * sizeof(double) && 1001 * sizeof(double) <= offset + length) {
+                weights_arrived.set_value();
+            }
+        });
 
-    // Listen for updates from other nodes
-    while (true) {
-        dsm.listen_for_updates();
-        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        // A shared array: only the elements written travel
+        const int weights = dsm.share<double>("weights", 1024);
+
+        if (rank == 0) {
+            // Subscribe to variables
+            dsm.subscribe("var1");
+            dsm.subscribe("var2");
+
+            // Both updates leave in one message per subscriber
+            std::cout << "Process 0 writing to var1 and var2" << std::endl;
+            dsm.begin_batch();
+            dsm.write("var1", 42);  // Process 0 writes to var1
+            dsm.compare_and_exchange("var2", INITIALIZED, 100);  // If var2 == 0, set it to 100
+            dsm.store(weights, 0.5, 3);
+            dsm.store(weights, 0.25, 1000);
+            dsm.commit();
+        }
 
         if (rank == 1) {
+            // Wait for process 0's writes instead of polling for them. The array has to be waited for on its own:
+            // with RMA, var1 can be stored before the array's update arrives.
+            dsm.when("var1", [](int value) { return value == 42; }).wait();
+            weights_arrived.get_future().wait();
+            std::cout << "weights[1000] is " << dsm.load<double>(weights, 1000) << std::endl;
             dsm.compare_and_exchange("var1", 42, 1500);  // Process 1 writes to var1
         }
+
+        // Everybody stops once the last write of the demo has reached them
+        dsm.when("var1", [](int value) { return value == 1500; }).wait();
     }
 
     MPI_Finalize();
     return 0;
-}
\ No newline at end of file
+}
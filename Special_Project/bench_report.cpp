@@ -0,0 +1,83 @@
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "benchmark.h"
+
+// Turns the rows the solvers appended (see benchmark.h) into scaling efficiencies, one line per
+// engine, graph (or weak-scaling series), mode and worker layout:
+//  - strong scaling, same graph on more workers: speedup = T(base) / T(p)
+//  - weak scaling, a series whose graph grows with the workers: the work of a search does not grow
+//    in step with the graph, so speedup compares throughput instead, nodes/s(p) / nodes/s(base)
+// Efficiency is speedup * base workers / p either way. The base is the run with the fewest workers,
+// and of repeated runs with the same layout the fastest one counts.
+//
+// Usage: ColouringBenchReport results.csv [scaling.csv]
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " results.csv [scaling.csv]" << std::endl;
+        return 1;
+    }
+
+    std::vector<BenchmarkRow> rows;
+    try {
+        rows = readBenchmarkRows(argv[1]);
+    } catch (const std::runtime_error &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    // engine, graph or series, mode, colors -> (workers, ranks) -> best run. The graphs of a series differ,
+    // and with them the default number of colors, so a series is one group whatever its colors.
+    using Group = std::tuple<std::string, std::string, std::string, int>;
+    std::map<Group, std::map<std::pair<int, int>, BenchmarkRow> > groups;
+    for (const BenchmarkRow &row: rows) {
+        auto &runs = groups[{row.engine, row.series.empty() ? row.graph : row.series, row.mode,
+                             row.series.empty() ? row.colors : 0}];
+        const std::pair<int, int> layout{row.workers(), row.ranks};
+        const auto it = runs.find(layout);
+        if (it == runs.end() || row.seconds < it->second.seconds) {
+            runs[layout] = row;
+        }
+    }
+
+    std::ofstream file;
+    if (argc > 2) {
+        file.open(argv[2]);
+        if (!file) {
+            std::cerr << "Cannot write " << argv[2] << std::endl;
+            return 1;
+        }
+    }
+    std::ostream &out = argc > 2 ? file : std::cout;
+
+    out << "engine,scaling,graph,mode,colors,workers,ranks,threads,seconds,nodes_per_second,first_solution_seconds,"
+            "speedup,efficiency\n";
+    for (const auto &[group, runs]: groups) {
+        const auto &[engine, name, mode, groupColors] = group;
+        const BenchmarkRow &base = runs.begin()->second;
+        const bool weak = !base.series.empty();
+
+        for (const auto &[layout, row]: runs) {
+            double speedup = 0;
+            if (weak) {
+                speedup = base.nodesPerSecond() > 0 ? row.nodesPerSecond() / base.nodesPerSecond() : 0;
+            } else {
+                speedup = row.seconds > 0 ? base.seconds / row.seconds : 0;
+            }
+            const double efficiency = speedup * base.workers() / row.workers();
+
+            out << engine << ',' << (weak ? "weak" : "strong") << ',' << name << ',' << mode << ',' << row.colors << ','
+                    << row.workers() << ',' << row.ranks << ',' << row.threads << ',' << row.seconds << ','
+                    << row.nodesPerSecond() << ',' << row.firstSolution << ',' << speedup << ',' << efficiency
+                    << '\n';
+        }
+    }
+    return 0;
+}
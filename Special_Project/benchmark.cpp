@@ -0,0 +1,77 @@
+#include "benchmark.h"
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+static const char *HEADER =
+        "engine,graph,series,vertices,edges,ranks,threads,workers,mode,colors,seconds,nodes,nodes_per_second,"
+        "first_solution_seconds,result";
+static const int COLUMNS = 15;
+
+void appendBenchmarkRow(const std::string &path, const BenchmarkRow &row) {
+    const bool fresh = !std::ifstream(path).good();
+    std::ofstream out(path, std::ios::app);
+    if (!out) {
+        throw std::runtime_error("Cannot append to " + path);
+    }
+    if (fresh) {
+        out << HEADER << '\n';
+    }
+    out << row.engine << ',' << row.graph << ',' << row.series << ',' << row.vertices << ',' << row.edges << ','
+            << row.ranks << ',' << row.threads << ',' << row.workers() << ',' << row.mode << ',' << row.colors << ','
+            << row.seconds << ',' << row.nodes << ',' << row.nodesPerSecond() << ',' << row.firstSolution << ','
+            << row.result << '\n';
+}
+
+std::vector<BenchmarkRow> readBenchmarkRows(const std::string &path) {
+    std::ifstream in(path);
+    if (!in) {
+        throw std::runtime_error("Cannot open " + path);
+    }
+
+    std::vector<BenchmarkRow> rows;
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(in, line)) {
+        ++lineNumber;
+        if (line.empty() || line == HEADER) {
+            continue;
+        }
+
+        std::vector<std::string> fields;
+        std::stringstream cells(line);
+        std::string cell;
+        while (std::getline(cells, cell, ',')) {
+            fields.push_back(cell);
+        }
+        if (!line.empty() && line.back() == ',') {
+            fields.emplace_back(); // getline drops a trailing empty cell
+        }
+        if (static_cast<int>(fields.size()) != COLUMNS) {
+            throw std::runtime_error(path + ":" + std::to_string(lineNumber) + ": expected " +
+                                     std::to_string(COLUMNS) + " columns");
+        }
+
+        // workers and nodes_per_second are derived, so they are not read back
+        BenchmarkRow row;
+        try {
+            row.engine = fields[0];
+            row.graph = fields[1];
+            row.series = fields[2];
+            row.vertices = std::stoi(fields[3]);
+            row.edges = std::stoll(fields[4]);
+            row.ranks = std::stoi(fields[5]);
+            row.threads = std::stoi(fields[6]);
+            row.mode = fields[8];
+            row.colors = std::stoi(fields[9]);
+            row.seconds = std::stod(fields[10]);
+            row.nodes = std::stoll(fields[11]);
+            row.firstSolution = std::stod(fields[13]);
+            row.result = fields[14];
+        } catch (const std::logic_error &) {
+            throw std::runtime_error(path + ":" + std::to_string(lineNumber) + ": bad number");
+        }
+        rows.push_back(std::move(row));
+    }
+    return rows;
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <string>
+#include <vector>
+
+/**
+ * One solver run as a line of the benchmark CSV. The solvers append one when given --csv;
+ * ColouringBenchReport reads them back and works out the scaling efficiencies.
+ */
+struct BenchmarkRow {
+    std::string engine; // threads, mpi or hybrid
+    std::string graph; // Generator spec, file name, or "example"
+    std::string series; // Weak-scaling runs whose graph grows with the workers share a series name; empty otherwise
+    int vertices = 0;
+    long long edges = 0;
+    int ranks = 1;
+    int threads = 1; // Per rank
+    std::string mode;
+    int colors = 0;
+    double seconds = 0;
+    long long nodes = 0;
+    double firstSolution = -1; // Seconds until any worker completed a coloring, -1 if none did
+    std::string result; // colorable, none, timeout, colorings=<count> or chromatic=<k>
+
+    int workers() const { return ranks * threads; }
+    double nodesPerSecond() const { return seconds > 0 ? static_cast<double>(nodes) / seconds : 0; }
+};
+
+// Appends to the CSV at path, writing the header first if the file is new. Throws std::runtime_error.
+void appendBenchmarkRow(const std::string &path, const BenchmarkRow &row);
+
+// Every row of such a file, header skipped. Throws std::runtime_error.
+std::vector<BenchmarkRow> readBenchmarkRows(const std::string &path);
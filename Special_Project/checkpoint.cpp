@@ -0,0 +1,385 @@
+#include "checkpoint.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+    const char MAGIC[8] = {'N', 'C', 'O', 'L', 'C', 'K', 'P', '1'};
+
+    // MPI-IO counts are ints: bigger reads go in pieces of this many bytes
+    const long long READ_CHUNK = 1 << 30;
+
+    struct FileHeader {
+        char magic[8];
+        std::int64_t epoch; // 0 while the file is being rewritten
+        std::int64_t edges;
+        std::int64_t dataBytes; // Of all blocks together
+        std::int32_t vertices;
+        std::int32_t mode;
+        std::int32_t m;
+        std::int32_t core;
+        std::int32_t lowerBound;
+        std::int32_t coreVertices;
+        std::int32_t blocks;
+        std::int32_t unused;
+    };
+    static_assert(sizeof(FileHeader) == 64);
+
+    struct BlockHeader {
+        std::int64_t nodes;
+        std::uint64_t colorings;
+        std::uint64_t classes;
+        std::int32_t items;
+        std::int32_t hasIncumbent;
+    };
+    static_assert(sizeof(BlockHeader) == 32);
+
+    std::string fileName(const std::string &path, int slot) {
+        return path + "." + std::to_string(slot);
+    }
+
+    // The header, then the coloring of the earlier cores; the blocks start on the next multiple of 8
+    MPI_Offset dataStart(int vertices) {
+        return (static_cast<MPI_Offset>(sizeof(FileHeader)) + vertices + 7) / 8 * 8;
+    }
+
+    void appendBytes(std::vector<unsigned char> &out, const void *data, std::size_t bytes) {
+        const std::size_t at = out.size();
+        out.resize(at + bytes);
+        std::memcpy(out.data() + at, data, bytes);
+    }
+
+    void appendColors(std::vector<unsigned char> &out, const std::vector<int> &coloring) {
+        for (int c: coloring) {
+            out.push_back(static_cast<unsigned char>(c)); // Colors are at most 64, one byte is plenty
+        }
+    }
+
+    bool validHeader(const FileHeader &header) {
+        return !std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) && header.epoch > 0 && header.vertices >= 0 &&
+               header.coreVertices >= 0 && header.coreVertices <= header.vertices && header.blocks >= 0 &&
+               header.dataBytes >= 0;
+    }
+
+    // Collective: the header of a checkpoint file, or nullopt if it does not exist or holds no valid one
+    std::optional<FileHeader> readHeader(MPI_File file) {
+        MPI_Offset size = 0;
+        MPI_File_get_size(file, &size);
+        FileHeader header{};
+        if (size < static_cast<MPI_Offset>(sizeof(FileHeader))) {
+            return std::nullopt;
+        }
+        MPI_File_read_at_all(file, 0, &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE);
+        if (!validHeader(header) || size < dataStart(header.vertices) + header.dataBytes) {
+            return std::nullopt;
+        }
+        return header;
+    }
+
+    template<typename T>
+    T take(const unsigned char *&p) {
+        T value;
+        std::memcpy(&value, p, sizeof(T));
+        p += sizeof(T);
+        return value;
+    }
+
+    // Everything after the header: the coloring of the earlier cores, then the blocks
+    std::vector<unsigned char> readData(MPI_File file, const FileHeader &header) {
+        std::vector<unsigned char> bytes(dataStart(header.vertices) - sizeof(FileHeader) + header.dataBytes);
+        for (long long done = 0; done < static_cast<long long>(bytes.size()); done += READ_CHUNK) {
+            const int chunk = static_cast<int>(std::min<long long>(READ_CHUNK,
+                                                                   static_cast<long long>(bytes.size()) - done));
+            MPI_File_read_at_all(file, static_cast<MPI_Offset>(sizeof(FileHeader)) + done, bytes.data() + done,
+                                 chunk, MPI_BYTE, MPI_STATUS_IGNORE);
+        }
+        return bytes;
+    }
+
+    // The blocks the header announces take up exactly dataBytes, each within its bounds
+    bool blocksFit(const FileHeader &header, const std::vector<unsigned char> &bytes) {
+        const long long n = header.coreVertices;
+        long long at = dataStart(header.vertices) - sizeof(FileHeader);
+        for (int b = 0; b < header.blocks; ++b) {
+            if (at + static_cast<long long>(sizeof(BlockHeader)) > static_cast<long long>(bytes.size())) {
+                return false;
+            }
+            const unsigned char *p = bytes.data() + at;
+            const auto block = take<BlockHeader>(p);
+            if (block.items < 0 || (block.hasIncumbent != 0 && block.hasIncumbent != 1) ||
+                (block.hasIncumbent && n == 0)) {
+                return false;
+            }
+            at += static_cast<long long>(sizeof(BlockHeader)) + block.hasIncumbent * n +
+                  block.items * (static_cast<long long>(sizeof(std::int32_t)) + n);
+            if (at > static_cast<long long>(bytes.size())) {
+                return false;
+            }
+        }
+        return at == static_cast<long long>(bytes.size());
+    }
+}
+
+Checkpointer::Checkpointer(const std::string &path, const Graph &graph, SolveMode mode, int m,
+                           double intervalSeconds) : path(path), vertices(graph.size()), edges(graph.edgeCount()),
+                                                     mode(mode), m(m), interval(intervalSeconds),
+                                                     lastTime(MPI_Wtime()) {
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    for (int slot = 0; slot < 2; ++slot) {
+        if (MPI_File_open(MPI_COMM_WORLD, fileName(path, slot).c_str(), MPI_MODE_CREATE | MPI_MODE_RDWR,
+                          MPI_INFO_NULL, &files[slot]) != MPI_SUCCESS) {
+            throw std::runtime_error("Cannot open checkpoint file " + fileName(path, slot));
+        }
+        // Keep counting from a checkpoint left on disk, so the next one lands in the other file
+        if (const auto header = readHeader(files[slot])) {
+            lastEpoch = std::max<long long>(lastEpoch, header->epoch);
+        }
+    }
+}
+
+Checkpointer::~Checkpointer() {
+    for (auto &file: files) {
+        MPI_File_close(&file);
+    }
+    if (remove) {
+        // Nobody may still have them open
+        MPI_Barrier(MPI_COMM_WORLD);
+        if (rank == 0) {
+            MPI_File_delete(fileName(path, 0).c_str(), MPI_INFO_NULL);
+            MPI_File_delete(fileName(path, 1).c_str(), MPI_INFO_NULL);
+        }
+    }
+}
+
+void Checkpointer::beginJob(const RunPosition &next, int vertices, MPI_Comm jobComm) {
+    position = next;
+    coreVertices = vertices;
+    comm = jobComm;
+    int size;
+    MPI_Comm_size(comm, &size);
+    sizes.assign(2 * static_cast<std::size_t>(size), 0);
+}
+
+bool Checkpointer::due() const {
+    return rank == 0 && stage == Stage::Idle && MPI_Wtime() - lastTime >= interval;
+}
+
+void Checkpointer::begin(FrontierShare share, bool awaitingReply) {
+    // Rank 0 only calls for the next one once the last is written everywhere; our own Ibarrier may just not
+    // have been tested since
+    while (stage != Stage::Idle) {
+        progress();
+    }
+    lastTime = MPI_Wtime();
+
+    // The file about to be overwritten stops being a checkpoint before anybody writes to it; rank 0 also
+    // writes the coloring of the earlier cores, which is synced along with its block
+    if (rank == 0) {
+        FileHeader invalid{};
+        std::memcpy(invalid.magic, MAGIC, sizeof(MAGIC));
+        MPI_File file = files[(lastEpoch + 1) % 2];
+        MPI_File_write_at(file, 0, &invalid, sizeof(invalid), MPI_BYTE, MPI_STATUS_IGNORE);
+        std::vector<unsigned char> colors;
+        appendColors(colors, position.coloring);
+        MPI_File_write_at(file, sizeof(FileHeader), colors.data(), static_cast<int>(colors.size()), MPI_BYTE,
+                          MPI_STATUS_IGNORE);
+    }
+
+    BlockHeader header{};
+    header.nodes = share.nodes;
+    header.colorings = share.count.colorings;
+    header.classes = share.count.classes;
+    header.hasIncumbent = !share.incumbent.empty();
+    block.clear();
+    appendBytes(block, &header, sizeof(header));
+    if (header.hasIncumbent) {
+        appendColors(block, share.incumbent);
+    }
+    itemCount = 0;
+    for (const WorkItem &item: share.items) {
+        appendItem(item);
+    }
+
+    stage = Stage::Snapshot;
+    waiting = awaitingReply;
+    mine[1] = 0;
+    if (!waiting) {
+        progress();
+    }
+}
+
+void Checkpointer::appendItem(const WorkItem &item) {
+    const std::int32_t depth = item.depth;
+    appendBytes(block, &depth, sizeof(depth));
+    appendColors(block, item.coloring);
+    ++itemCount;
+}
+
+void Checkpointer::addReply(const std::vector<WorkItem> &batch) {
+    for (const WorkItem &item: batch) {
+        appendItem(item);
+    }
+    waiting = false;
+    progress();
+}
+
+void Checkpointer::progress() {
+    int flag = 0;
+    switch (stage) {
+        case Stage::Idle:
+            return;
+        case Stage::Snapshot:
+            if (waiting) {
+                return;
+            }
+            // Our part is complete: patch in the item count and tell everybody how big it is
+            std::memcpy(block.data() + offsetof(BlockHeader, items), &itemCount, sizeof(itemCount));
+            mine[0] = static_cast<long long>(block.size());
+            MPI_Iallgather(mine, 2, MPI_LONG_LONG, sizes.data(), 2, MPI_LONG_LONG, comm, &request);
+            stage = Stage::Sizes;
+            return;
+        case Stage::Sizes: {
+            MPI_Test(&request, &flag, MPI_STATUS_IGNORE);
+            if (!flag) {
+                return;
+            }
+            MPI_Offset offset = dataStart(vertices);
+            for (int r = 0; r < rank; ++r) {
+                offset += sizes[2 * r];
+            }
+            MPI_File_iwrite_at_all(files[(lastEpoch + 1) % 2], offset, block.data(), static_cast<int>(block.size()),
+                                   MPI_BYTE, &request);
+            stage = Stage::Writing;
+            return;
+        }
+        case Stage::Writing:
+            MPI_Test(&request, &flag, MPI_STATUS_IGNORE);
+            if (flag) {
+                // Our part is on the disk before the barrier tells rank 0 it may write the header
+                MPI_File_sync(files[(lastEpoch + 1) % 2]);
+                MPI_Ibarrier(comm, &request);
+                stage = Stage::Syncing;
+            }
+            return;
+        case Stage::Syncing:
+            MPI_Test(&request, &flag, MPI_STATUS_IGNORE);
+            if (!flag) {
+                return;
+            }
+            // Every part is on disk; it only counts if none of them is missing a batch
+            bool broken = false;
+            for (std::size_t r = 0; r < sizes.size(); r += 2) {
+                broken = broken || sizes[r + 1];
+            }
+            if (!broken) {
+                if (rank == 0) {
+                    publish();
+                }
+                MPI_File_sync(files[(lastEpoch + 1) % 2]);
+                ++lastEpoch;
+            }
+            stage = Stage::Idle;
+            return;
+    }
+}
+
+void Checkpointer::publish() {
+    FileHeader header{};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.epoch = lastEpoch + 1;
+    header.edges = edges;
+    for (std::size_t r = 0; r < sizes.size(); r += 2) {
+        header.dataBytes += sizes[r];
+    }
+    header.vertices = vertices;
+    header.mode = static_cast<std::int32_t>(mode);
+    header.m = m;
+    header.core = position.core;
+    header.lowerBound = position.lowerBound;
+    header.coreVertices = coreVertices;
+    header.blocks = static_cast<std::int32_t>(sizes.size() / 2);
+    MPI_File_write_at(files[(lastEpoch + 1) % 2], 0, &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE);
+}
+
+void Checkpointer::finish() {
+    // The victim of our steal request stopped without answering it
+    if (stage == Stage::Snapshot && waiting) {
+        waiting = false;
+        mine[1] = 1;
+        progress();
+    }
+}
+
+std::optional<Resume> loadCheckpoint(const std::string &path, const Graph &graph, SolveMode mode, int m,
+                                     int rank, int numProcs) {
+    // The newer of the two files that holds a complete checkpoint. Every rank reads all of it and keeps its
+    // own share; one whose blocks do not add up counts as invalid as well.
+    FileHeader header{};
+    std::vector<unsigned char> bytes;
+    for (int slot = 0; slot < 2; ++slot) {
+        MPI_File candidate;
+        if (MPI_File_open(MPI_COMM_WORLD, fileName(path, slot).c_str(), MPI_MODE_RDONLY, MPI_INFO_NULL,
+                          &candidate) != MPI_SUCCESS) {
+            continue;
+        }
+        const auto found = readHeader(candidate);
+        if (found && found->epoch > header.epoch) {
+            auto data = readData(candidate, *found);
+            if (blocksFit(*found, data)) {
+                header = *found;
+                bytes = std::move(data);
+            }
+        }
+        MPI_File_close(&candidate);
+    }
+    if (header.epoch == 0) {
+        return std::nullopt;
+    }
+
+    if (header.vertices != graph.size() || header.edges != graph.edgeCount() ||
+        header.mode != static_cast<std::int32_t>(mode) || header.m != m) {
+        throw std::runtime_error("Checkpoint " + path + " was written for another graph, mode or number of colors");
+    }
+
+    Resume resume;
+    resume.epoch = header.epoch;
+    resume.position.core = header.core;
+    resume.position.lowerBound = header.lowerBound;
+    resume.position.coloring.assign(bytes.begin(), bytes.begin() + header.vertices);
+    resume.coreVertices = header.coreVertices;
+
+    const int n = header.coreVertices;
+    FrontierShare total;
+    int bestColors = m + 1;
+    long long index = 0; // Of the item across all blocks
+    const unsigned char *p = bytes.data() + (dataStart(header.vertices) - sizeof(FileHeader));
+    for (int b = 0; b < header.blocks; ++b) {
+        const auto block = take<BlockHeader>(p);
+        total.nodes += block.nodes;
+        total.count.colorings += block.colorings;
+        total.count.classes += block.classes;
+        if (block.hasIncumbent) {
+            const std::vector<int> coloring(p, p + n);
+            const int used = *std::max_element(coloring.begin(), coloring.end());
+            if (used < bestColors) {
+                bestColors = used;
+                resume.share.incumbent = coloring;
+            }
+            p += n;
+        }
+        for (int k = 0; k < block.items; ++k, ++index) {
+            const auto depth = take<std::int32_t>(p);
+            if (index % numProcs == rank) {
+                resume.share.items.push_back(WorkItem{std::vector<int>(p, p + n), depth});
+            }
+            p += n;
+        }
+    }
+    if (rank == 0) {
+        resume.share.nodes = total.nodes;
+        resume.share.count = total.count;
+    }
+    return resume;
+}
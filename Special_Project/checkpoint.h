@@ -0,0 +1,120 @@
+#pragma once
+#include <mpi.h>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "graph.h"
+#include "local_search.h"
+#include "search_goal.h"
+
+static const int TAG_CHECKPOINT = 7; // Rank 0 says: take your part of the next checkpoint now
+
+// Where the run stood when a checkpoint was taken, apart from the search itself
+struct RunPosition {
+    int core = 0; // Index of the core being searched (see solveDecomposed())
+    int lowerBound = 1; // Of that core's goal
+    std::vector<int> coloring; // The cores colored before it, in a coloring of the whole graph (0 = not yet)
+};
+
+// One rank's part of a checkpoint
+struct FrontierShare {
+    std::vector<WorkItem> items; // Still to search, see LocalSearch::frontier()
+    long long nodes = 0; // Explored so far, restarts included
+    SolutionCount count; // Count mode: counted so far, restarts included
+    std::vector<int> incumbent; // Chromatic mode: the best coloring of the core so far, empty if none
+};
+
+// A checkpoint read back and dealt out to the ranks of the new run
+struct Resume {
+    long long epoch = 0;
+    RunPosition position;
+    int coreVertices = 0; // Of the core it was taken in, to check the new run split the graph alike
+    FrontierShare share; // Every P-th item for each of the P ranks, the incumbent for all, the counters to rank 0
+};
+
+/**
+ * Periodic checkpoints of the MPI engine, taken while the search goes on.
+ *
+ * Work only ever moves between ranks as the reply to a steal request, and a rank has at most one of
+ * those out at a time, so a consistent cut is cheap: rank 0 sends every rank a TAG_CHECKPOINT, each
+ * rank takes its snapshot (LocalSearch::frontier() and its counters) as soon as it sees it, and
+ * neither gives work away nor asks for any until the checkpoint is written. So a batch still on its
+ * way when the thief took its snapshot was asked for before, and went out before the victim took its
+ * own: the thief adds it to its part.
+ *
+ * The parts go to disk with nonblocking collectives (MPI_Iallgather for the offsets,
+ * MPI_File_iwrite_at_all for the data, MPI_Ibarrier), which progress() moves along between search
+ * steps. Every rank syncs its part to disk before the barrier; rank 0 then writes the header, and only
+ * that makes the checkpoint valid, and a second MPI_File_sync puts the header on disk too. Checkpoints
+ * alternate between `path`.0 and `path`.1, so a kill in the middle of one leaves the previous intact.
+ *
+ * File layout (native byte order): a 64-byte header, the coloring of the cores done before (one byte
+ * per vertex), padding to 8, then one block per rank: {int64 nodes; uint64 colorings; uint64 classes;
+ * int32 items; int32 hasIncumbent}, the incumbent (one byte per core vertex) if any, and the items
+ * as {int32 depth; uint8 colors[core vertices]}.
+ */
+class Checkpointer {
+public:
+    // Collective over MPI_COMM_WORLD: opens (creates) both files. The problem is written into every header.
+    Checkpointer(const std::string &path, const Graph &graph, SolveMode mode, int m, double intervalSeconds);
+    ~Checkpointer(); // Collective: closes the files, and deletes them once removeOnClose() was called
+    Checkpointer(const Checkpointer &) = delete;
+    Checkpointer &operator=(const Checkpointer &) = delete;
+
+    // Every rank, before the next job starts: it searches a core of coreVertices vertices over comm
+    void beginJob(const RunPosition &position, int coreVertices, MPI_Comm comm);
+
+    bool due() const; // Rank 0: time for the next one, and none in progress
+    bool active() const { return stage != Stage::Idle; } // Give no work away while true
+
+    // This rank's snapshot, taken right now. awaitingReply: a steal request of ours is out, and whatever
+    // the reply brings belongs to this checkpoint too (see addReply()).
+    void begin(FrontierShare share, bool awaitingReply);
+    bool awaitingReply() const { return stage == Stage::Snapshot && waiting; }
+    void addReply(const std::vector<WorkItem> &batch);
+
+    void progress(); // Moves the writes along; blocks only in MPI_File_sync, which every rank reaches
+    // End of the job: stop waiting for a reply the victim may never send. progress() still has to
+    // complete a checkpoint in progress (see drainUntilQuiet()), which is then not published.
+    void finish();
+
+    void removeOnClose() { remove = true; } // The run finished, there is nothing left to restart
+
+private:
+    enum class Stage { Idle, Snapshot, Sizes, Writing, Syncing };
+
+    void appendItem(const WorkItem &item);
+    void publish(); // Rank 0: header last
+
+    std::string path;
+    MPI_File files[2] = {MPI_FILE_NULL, MPI_FILE_NULL};
+    int rank = 0;
+    int vertices; // Of the whole graph
+    long long edges;
+    SolveMode mode;
+    int m;
+    double interval;
+
+    RunPosition position;
+    int coreVertices = 0;
+    MPI_Comm comm = MPI_COMM_NULL;
+
+    Stage stage = Stage::Idle;
+    bool waiting = false;
+    bool remove = false;
+    long long lastEpoch = 0; // Of the last one published, or found on disk when the files were opened
+    double lastTime; // When the last one was started
+    std::vector<unsigned char> block; // This rank's part
+    std::int32_t itemCount = 0;
+    std::vector<long long> sizes; // {bytes, broken} of every rank's part
+    long long mine[2] = {0, 0};
+    MPI_Request request = MPI_REQUEST_NULL;
+};
+
+// Reads the newest valid checkpoint of `path` (see Checkpointer), if there is one, and deals it out to
+// this rank of numProcs, whatever the rank count that wrote it. Collective over MPI_COMM_WORLD.
+// Throws std::runtime_error if it was written for another graph, mode or number of colors.
+std::optional<Resume> loadCheckpoint(const std::string &path, const Graph &graph, SolveMode mode, int m,
+                                     int rank, int numProcs);
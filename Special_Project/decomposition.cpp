@@ -0,0 +1,181 @@
+#include "decomposition.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <thread>
+
+namespace {
+    // Below this many vertices per thread the threads cost more than the unions they share
+    const int MIN_VERTICES_PER_THREAD = 4096;
+
+    // A core this small gets this many bytes of nogood cache per vertex, up to the configured size
+    const std::size_t NOGOOD_BYTES_PER_VERTEX = 16 << 10;
+
+    /**
+     * Union-find the threads share without a lock. Only roots are ever linked, with a CAS that fails
+     * if somebody else linked that root first, and always the higher index under the lower one, so
+     * no cycle can form and every root ends up the smallest vertex of its set. find() halves the path
+     * with plain stores: a racing thread can only have moved the same pointer to another ancestor.
+     */
+    class ConcurrentUnionFind {
+    public:
+        explicit ConcurrentUnionFind(int n) : parent(n) {
+            for (int v = 0; v < n; ++v) {
+                parent[v].store(v, std::memory_order_relaxed);
+            }
+        }
+
+        int find(int v) {
+            while (true) {
+                const int p = parent[v].load(std::memory_order_relaxed);
+                if (p == v) {
+                    return v;
+                }
+                const int grand = parent[p].load(std::memory_order_relaxed);
+                if (grand != p) {
+                    parent[v].store(grand, std::memory_order_relaxed);
+                }
+                v = grand;
+            }
+        }
+
+        void unite(int a, int b) {
+            while (true) {
+                a = find(a);
+                b = find(b);
+                if (a == b) {
+                    return;
+                }
+                if (a < b) {
+                    std::swap(a, b);
+                }
+                int expected = a;
+                if (parent[a].compare_exchange_strong(expected, b, std::memory_order_relaxed)) {
+                    return;
+                }
+            }
+        }
+
+    private:
+        std::vector<std::atomic<int> > parent;
+    };
+
+    template<typename Fn>
+    void parallelFor(unsigned numThreads, Fn fn) {
+        std::vector<std::thread> threads;
+        for (unsigned t = 0; t < numThreads; ++t) {
+            threads.emplace_back(fn, t);
+        }
+        for (auto &t: threads) {
+            t.join();
+        }
+    }
+}
+
+Decomposition decompose(const Graph &graph, int k, unsigned numThreads) {
+    const int n = graph.size();
+    Decomposition parts;
+
+    // k-core: a vertex goes once fewer than k of its neighbours are left. It is marked when it drops
+    // below k and only taken off its neighbours' degrees when its turn in the queue comes, so every
+    // vertex peeled after it (or left in the core) was still counted when it was marked.
+    std::vector<int> degree(n);
+    std::vector<char> removed(n, 0);
+    for (int v = 0; v < n; ++v) {
+        degree[v] = graph.degree(v);
+        if (degree[v] < k) {
+            removed[v] = 1;
+            parts.peeled.push_back(v);
+        }
+    }
+    for (std::size_t i = 0; i < parts.peeled.size(); ++i) {
+        for (int u: graph.neighbours(parts.peeled[i])) {
+            if (!removed[u] && --degree[u] < k) {
+                removed[u] = 1;
+                parts.peeled.push_back(u);
+            }
+        }
+    }
+
+    // Components of what is left; each thread unites the core edges of its own range of vertices
+    ConcurrentUnionFind sets(n);
+    const unsigned threads = std::clamp(static_cast<unsigned>(n / MIN_VERTICES_PER_THREAD), 1u, std::max(numThreads, 1u));
+    parallelFor(threads, [&](unsigned t) {
+        const int from = static_cast<int>(static_cast<long long>(n) * t / threads);
+        const int to = static_cast<int>(static_cast<long long>(n) * (t + 1) / threads);
+        for (int v = from; v < to; ++v) {
+            if (removed[v]) {
+                continue;
+            }
+            for (int u: graph.neighbours(v)) {
+                if (u > v && !removed[u]) {
+                    sets.unite(v, u);
+                }
+            }
+        }
+    });
+
+    // The root is the smallest vertex of its component, so it is met first and opens the core
+    std::vector<int> coreOf(n, -1);
+    for (int v = 0; v < n; ++v) {
+        if (removed[v]) {
+            continue;
+        }
+        const int root = sets.find(v);
+        if (coreOf[root] < 0) {
+            coreOf[root] = static_cast<int>(parts.cores.size());
+            parts.cores.emplace_back();
+        }
+        parts.cores[coreOf[root]].push_back(v);
+    }
+    std::stable_sort(parts.cores.begin(), parts.cores.end(), [](const auto &a, const auto &b) {
+        return a.size() > b.size();
+    });
+    return parts;
+}
+
+std::string describeDecomposition(const Decomposition &parts, int k) {
+    std::string line = "Peeled " + std::to_string(parts.peeled.size()) + " vertices with fewer than " +
+                       std::to_string(k) + " neighbours, " + std::to_string(parts.cores.size()) +
+                       " cores left to search";
+    if (!parts.cores.empty()) {
+        line += " (largest " + std::to_string(parts.cores.front().size()) + " vertices)";
+    }
+    return line;
+}
+
+Graph inducedSubgraph(const Graph &graph, const std::vector<int> &vertices) {
+    Graph sub(static_cast<int>(vertices.size()));
+    for (int i = 0; i < static_cast<int>(vertices.size()); ++i) {
+        for (int u: graph.neighbours(vertices[i])) {
+            const auto it = std::lower_bound(vertices.begin(), vertices.end(), u);
+            if (it != vertices.end() && *it == u && it - vertices.begin() > i) {
+                sub.addEdge(i, static_cast<int>(it - vertices.begin()));
+            }
+        }
+    }
+    return sub;
+}
+
+void placeCore(const std::vector<int> &core, const std::vector<int> &coreColor, std::vector<int> &color) {
+    for (std::size_t i = 0; i < core.size(); ++i) {
+        color[core[i]] = coreColor[i];
+    }
+}
+
+void colorPeeled(const Graph &graph, const std::vector<int> &peeled, std::vector<int> &color) {
+    for (auto it = peeled.rbegin(); it != peeled.rend(); ++it) {
+        std::uint64_t taken = 0; // Bit c-1 set = some neighbour has color c
+        for (int u: graph.neighbours(*it)) {
+            if (color[u] > 0) {
+                taken |= std::uint64_t{1} << (color[u] - 1);
+            }
+        }
+        color[*it] = std::countr_one(taken) + 1;
+    }
+}
+
+std::size_t coreNogoodBytes(std::size_t configured, std::size_t vertices) {
+    return std::min(configured, vertices * NOGOOD_BYTES_PER_VERTEX);
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "graph.h"
+
+/**
+ * The part of a coloring problem that actually needs a search.
+ *
+ * A vertex with fewer than k neighbours can always be colored last with one of k colors, whatever
+ * its neighbours got, so it is peeled off, and the neighbours' degrees drop with it: what is left
+ * is the k-core. With k = m the whole graph is m-colorable iff the core is; with k = the clique
+ * bound the chromatic number is the larger of the bound and that of the core. The core then falls
+ * apart into connected components, which are colored independently.
+ */
+struct Decomposition {
+    std::vector<int> peeled; // In the order they were peeled; colorPeeled() goes backwards
+    std::vector<std::vector<int> > cores; // Vertices of each component left, ascending; largest core first
+};
+
+// Peels the graph down to its k-core (k = 0 keeps everything) and splits the core into connected
+// components with a lock-free union-find over its edges, on numThreads threads. Every call on the same
+// graph and k gives the same result, whatever the thread count.
+Decomposition decompose(const Graph &graph, int k, unsigned numThreads);
+
+// One line for the log: how much was peeled and what is left to search
+std::string describeDecomposition(const Decomposition &parts, int k);
+
+// The graph induced by `vertices` (ascending); vertex i of the result is vertices[i]
+Graph inducedSubgraph(const Graph &graph, const std::vector<int> &vertices);
+
+// Copies the coloring of a core (indexed like inducedSubgraph's result) into the coloring of the whole graph
+void placeCore(const std::vector<int> &core, const std::vector<int> &coreColor, std::vector<int> &color);
+
+// Gives every peeled vertex the lowest color none of its neighbours has, last peeled first. Each has
+// fewer than k colored neighbours when its turn comes, so no more than max(k, colors in use) are needed.
+void colorPeeled(const Graph &graph, const std::vector<int> &peeled, std::vector<int> &color);
+
+// Nogood cache for one job: a small core is searched long before zeroing the full table would pay off
+std::size_t coreNogoodBytes(std::size_t configured, std::size_t vertices);
@@ -0,0 +1,149 @@
+#include "generators.h"
+#include <cmath>
+#include <cstdlib>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+    // Uniform in [0, 1) from the top 53 bits, identical wherever mt19937_64 is
+    double uniform(std::mt19937_64 &rng) {
+        return static_cast<double>(rng() >> 11) * 0x1.0p-53;
+    }
+
+    std::vector<std::string> splitSpec(const std::string &spec) {
+        std::vector<std::string> fields;
+        std::stringstream in(spec);
+        std::string field;
+        while (std::getline(in, field, ':')) {
+            fields.push_back(field);
+        }
+        return fields;
+    }
+
+    // Whole field or nothing: "12x" is as wrong as "x"
+    long long parseInt(const std::string &field, const std::string &spec) {
+        char *end = nullptr;
+        const long long value = std::strtoll(field.c_str(), &end, 10);
+        if (field.empty() || *end != '\0') {
+            throw std::runtime_error("Bad number '" + field + "' in graph spec " + spec);
+        }
+        return value;
+    }
+
+    double parseReal(const std::string &field, const std::string &spec) {
+        char *end = nullptr;
+        const double value = std::strtod(field.c_str(), &end);
+        if (field.empty() || *end != '\0') {
+            throw std::runtime_error("Bad number '" + field + "' in graph spec " + spec);
+        }
+        return value;
+    }
+}
+
+Graph erdosRenyi(int n, double p, std::uint64_t seed) {
+    std::mt19937_64 rng(seed);
+    Graph graph(n);
+    for (int u = 0; u < n; ++u) {
+        for (int v = u + 1; v < n; ++v) {
+            if (uniform(rng) < p) {
+                graph.addEdge(u, v);
+            }
+        }
+    }
+    return graph;
+}
+
+Graph randomGeometric(int n, double radius, std::uint64_t seed) {
+    std::mt19937_64 rng(seed);
+    std::vector<double> x(n), y(n);
+    for (int v = 0; v < n; ++v) {
+        x[v] = uniform(rng);
+        y[v] = uniform(rng);
+    }
+
+    Graph graph(n);
+    for (int u = 0; u < n; ++u) {
+        for (int v = u + 1; v < n; ++v) {
+            const double dx = x[u] - x[v];
+            const double dy = y[u] - y[v];
+            if (dx * dx + dy * dy <= radius * radius) {
+                graph.addEdge(u, v);
+            }
+        }
+    }
+    return graph;
+}
+
+Graph mycielski(int k) {
+    if (k <= 1) {
+        return Graph(k < 1 ? 0 : 1);
+    }
+
+    // Start from K_2 and apply the construction k - 2 times: every vertex v gets a shadow u adjacent to
+    // v's neighbours, and one extra vertex w is adjacent to all the shadows
+    std::vector<std::pair<int, int> > edges = {{0, 1}};
+    int n = 2;
+    for (int step = 2; step < k; ++step) {
+        const std::size_t original = edges.size();
+        for (std::size_t e = 0; e < original; ++e) {
+            const auto [a, b] = edges[e];
+            edges.emplace_back(n + a, b);
+            edges.emplace_back(n + b, a);
+        }
+        for (int v = 0; v < n; ++v) {
+            edges.emplace_back(n + v, 2 * n);
+        }
+        n = 2 * n + 1;
+    }
+
+    Graph graph(n);
+    for (const auto &[a, b]: edges) {
+        graph.addEdge(a, b);
+    }
+    return graph;
+}
+
+Graph queen(int rows, int cols) {
+    Graph graph(rows * cols);
+    for (int r1 = 0; r1 < rows; ++r1) {
+        for (int c1 = 0; c1 < cols; ++c1) {
+            for (int r2 = r1; r2 < rows; ++r2) {
+                for (int c2 = 0; c2 < cols; ++c2) {
+                    if (r2 == r1 && c2 <= c1) {
+                        continue;
+                    }
+                    // Same row, same column or same diagonal
+                    if (r1 == r2 || c1 == c2 || std::abs(r1 - r2) == std::abs(c1 - c2)) {
+                        graph.addEdge(r1 * cols + c1, r2 * cols + c2);
+                    }
+                }
+            }
+        }
+    }
+    return graph;
+}
+
+Graph generateGraph(const std::string &spec) {
+    const std::vector<std::string> fields = splitSpec(spec);
+    const std::string family = fields.empty() ? "" : fields[0];
+
+    if (family == "gnp" && fields.size() == 4) {
+        return erdosRenyi(static_cast<int>(parseInt(fields[1], spec)), parseReal(fields[2], spec),
+                          static_cast<std::uint64_t>(parseInt(fields[3], spec)));
+    }
+    if (family == "geometric" && fields.size() == 4) {
+        return randomGeometric(static_cast<int>(parseInt(fields[1], spec)), parseReal(fields[2], spec),
+                               static_cast<std::uint64_t>(parseInt(fields[3], spec)));
+    }
+    if (family == "mycielski" && fields.size() == 2) {
+        return mycielski(static_cast<int>(parseInt(fields[1], spec)));
+    }
+    if (family == "queen" && (fields.size() == 2 || fields.size() == 3)) {
+        const int rows = static_cast<int>(parseInt(fields[1], spec));
+        return queen(rows, fields.size() == 3 ? static_cast<int>(parseInt(fields[2], spec)) : rows);
+    }
+    throw std::runtime_error("Unknown graph spec " + spec +
+                             " (expected gnp:n:p:seed, geometric:n:radius:seed, mycielski:k or queen:rows[:cols])");
+}
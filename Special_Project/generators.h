@@ -0,0 +1,19 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+#include "graph.h"
+
+/**
+ * The standard benchmark families, generated instead of loaded. A fixed seed gives the same graph
+ * on every machine and compiler: the random numbers are taken straight from std::mt19937_64 (whose
+ * output the standard pins down), never through the implementation-defined distributions.
+ */
+Graph erdosRenyi(int n, double p, std::uint64_t seed); // G(n, p): every edge independently with probability p
+Graph randomGeometric(int n, double radius, std::uint64_t seed); // Points in the unit square, edge when within radius
+Graph mycielski(int k); // Triangle-free with chromatic number k; M_1 = K_1, M_2 = K_2, M_3 = C_5, ...
+Graph queen(int rows, int cols); // One vertex per square, edge when a queen on one attacks the other
+
+// "gnp:<n>:<p>:<seed>", "geometric:<n>:<radius>:<seed>", "mycielski:<k>" or "queen:<rows>[:<cols>]".
+// Throws std::runtime_error for anything else.
+Graph generateGraph(const std::string &spec);
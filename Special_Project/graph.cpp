@@ -0,0 +1,37 @@
+#include "graph.h"
+#include <algorithm>
+#include <utility>
+
+Graph::Graph(int n) : n(n), lists(n) {
+}
+
+Graph::Graph(std::vector<std::vector<int> > neighbourLists) : n(static_cast<int>(neighbourLists.size())),
+                                                               lists(std::move(neighbourLists)) {
+    for (const std::vector<int> &list: lists) {
+        edges += static_cast<long long>(list.size());
+    }
+    edges /= 2;
+}
+
+void Graph::addEdge(int u, int v) {
+    if (u == v) {
+        return;
+    }
+
+    // Generators and loaders mostly add in increasing order, so the insertion point is usually the end
+    const auto at = std::lower_bound(lists[u].begin(), lists[u].end(), v);
+    if (at != lists[u].end() && *at == v) {
+        return;
+    }
+    lists[u].insert(at, v);
+    lists[v].insert(std::lower_bound(lists[v].begin(), lists[v].end(), u), u);
+    ++edges;
+}
+
+bool Graph::hasEdge(int u, int v) const {
+    // Search the shorter of the two lists
+    if (lists[u].size() > lists[v].size()) {
+        std::swap(u, v);
+    }
+    return std::binary_search(lists[u].begin(), lists[u].end(), v);
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <vector>
+
+/**
+ * Undirected graph sized at runtime, kept as one sorted, duplicate-free neighbour list per vertex:
+ * O(n + m) memory, so sparse graphs with millions of vertices fit, and hasEdge() is a binary search.
+ */
+class Graph {
+public:
+    explicit Graph(int n = 0);
+    // Adopts ready-made lists: each sorted and free of duplicates, v in lists[u] iff u in lists[v]
+    explicit Graph(std::vector<std::vector<int> > neighbourLists);
+
+    void addEdge(int u, int v); // Self loops are ignored, duplicate edges are harmless
+    bool hasEdge(int u, int v) const;
+
+    int size() const { return n; }
+    long long edgeCount() const { return edges; }
+    int degree(int v) const { return static_cast<int>(lists[v].size()); }
+    const std::vector<int> &neighbours(int v) const { return lists[v]; }
+
+private:
+    int n;
+    long long edges = 0;
+    std::vector<std::vector<int> > lists;
+};
@@ -0,0 +1,359 @@
+#include <mpi.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "instrumentation.h"
+#include "local_search.h"
+#include "mpi_common.h"
+#include "ordering.h"
+#include "thread_pool.h"
+#include "transport.h"
+
+using namespace std;
+
+// Nodes a search thread explores between two looks at the shared state
+static const long long POLL_INTERVAL = 256;
+
+/**
+ * What the search threads of one rank share. Every thread runs its own LocalSearch; the queue
+ * only fills up when somebody is hungry (an idle sibling, or a remote thief the communication
+ * thread is holding on to) and a busy thread splits branches off its stack into it.
+ * The goal (and with it the Chromatic mode bound and the nogood cache) is shared by all threads of the rank.
+ */
+struct NodeShared {
+    NodeShared(SolveMode mode, int m, int lowerBound, size_t nogoodBytes) : goal(mode, m, lowerBound, nogoodBytes) {
+    }
+
+    mutex mtx;
+    condition_variable cv;
+    deque<WorkItem> queue;
+
+    // Mirrors for the busy threads' lock-free "is anybody hungry?" check
+    atomic<int> idle{0}; // Threads parked waiting for the queue
+    atomic<int> queued{0}; // queue.size()
+    atomic<int> remoteWanted{0}; // Items the communication thread would like to hand to other ranks
+
+    atomic<bool> stop{false};
+    bool solved = false;
+    vector<int> solution;
+
+    SearchGoal goal;
+    SolutionCount counted; // Count mode: every thread adds its tally when it finishes
+    long long nodes = 0; // Likewise for the nodes explored
+};
+
+// Body of one search thread; runs as a long-lived task on the rank's ThreadPool
+void searchThread(NodeShared &node, const Graph &graph, int m, const Ordering &ordering) {
+    LocalSearch search(graph, m, ordering, node.goal);
+
+    while (!node.stop.load(memory_order_relaxed)) {
+        if (!search.hasWork()) {
+            const std::int64_t idleSince = traceNow();
+            unique_lock lock(node.mtx);
+            ++node.idle;
+            node.cv.wait(lock, [&node] { return node.stop.load() || !node.queue.empty(); });
+            --node.idle;
+            recordIdle(idleSince);
+            if (node.stop.load()) {
+                break;
+            }
+            search.push(std::move(node.queue.front()));
+            node.queue.pop_front();
+            node.queued = static_cast<int>(node.queue.size());
+            continue;
+        }
+
+        if (search.run(POLL_INTERVAL)) {
+            lock_guard lock(node.mtx);
+            if (!node.solved) {
+                node.solved = true;
+                node.solution = search.solution();
+            }
+            node.stop = true;
+            node.cv.notify_all();
+            break;
+        }
+
+        // Somebody is starving: split off branches close to our root for them
+        const int wanted = node.idle.load(memory_order_relaxed) + node.remoteWanted.load(memory_order_relaxed);
+        if (wanted > node.queued.load(memory_order_relaxed)) {
+            lock_guard lock(node.mtx);
+            WorkItem w;
+            while (static_cast<int>(node.queue.size()) < wanted && search.split(w)) {
+                node.queue.push_back(std::move(w));
+            }
+            node.queued = static_cast<int>(node.queue.size());
+            node.cv.notify_all();
+        }
+    }
+
+    bump(Counter::Nodes, search.nodes());
+    bump(Counter::Backtracks, search.backtracks());
+    lock_guard lock(node.mtx);
+    node.counted += search.counted();
+    node.nodes += search.nodes();
+}
+
+/**
+ * One rank per node. The main thread is the only one that talks MPI (MPI_THREAD_FUNNELED): it
+ * answers remote steal requests from the node queue, steals from random peers when the node runs
+ * dry, passes the termination token and reports or broadcasts the solution. The search itself
+ * runs on a pool of threads that share one copy of the graph.
+ * One call searches one graph (a core of the input, see solveDecomposed()); the outcome is left in
+ * the totals for the caller to print.
+ */
+RunTotals hybridCode(int rank, int numProcs, const Graph &graph, int m, int lowerBound, unsigned numThreads,
+                     const Ordering &ordering, SolveMode mode, size_t nogoodBytes, MPI_Comm comm) {
+    NodeShared node(mode, m, lowerBound, nogoodBytes);
+    if (rank == 0) {
+        node.queue.push_back(WorkItem{vector<int>(graph.size(), 0), 0});
+        node.queued = 1;
+    }
+
+    // The threads share the node's bound through an atomic; the ranks through this window
+    unique_ptr<SharedBound> bound;
+    if (mode == SolveMode::Chromatic) {
+        bound = make_unique<SharedBound>(m + 1, comm);
+    }
+
+    ThreadPool pool(numThreads);
+    for (unsigned t = 0; t < numThreads; ++t) {
+        pool.submit([&node, &graph, m, &ordering] { searchThread(node, graph, m, ordering); });
+    }
+
+    Termination term;
+    term.comm = comm;
+    term.haveToken = rank == 0; // Rank 0 launches the first round once it runs out of work
+    minstd_rand rng(7919u * rank + 1);
+    WorkTransport transport(graph.size(), comm);
+    vector<WorkItem> batch;
+    RunTotals totals;
+
+    bool done = false; // Rank 0 decided (or told us) that the search is over
+    bool reported = false; // Our own solution went out already
+    bool stealPending = false;
+    deque<int> thieves; // Remote ranks waiting for an answer from us
+
+    auto terminateAll = [&]() {
+        broadcastTerminate(numProcs, comm);
+        done = true;
+    };
+
+    while (!done) {
+        bool busy = false; // Did anything happen this round
+
+        // A local thread found a coloring
+        bool solved;
+        {
+            lock_guard lock(node.mtx);
+            solved = node.solved;
+        }
+        if (solved && !reported) {
+            reported = true;
+            if (rank == 0) {
+                if (mode == SolveMode::First) {
+                    totals.coloring = node.solution;
+                }
+                terminateAll();
+                break;
+            }
+            transport.send({WorkItem{node.solution, graph.size()}}, 0, TAG_RESULT);
+            term.workSent();
+        }
+
+        if (bound) {
+            node.goal.tighten(bound->exchange(node.goal.boundColors()));
+        }
+
+        // The answer to our own steal request
+        transport.progress();
+        if (stealPending && transport.test(batch)) {
+            stealPending = false;
+            busy = true;
+            bump(batch.empty() ? Counter::StealsEmpty : Counter::ItemsStolen, max<size_t>(batch.size(), 1));
+            if (!batch.empty()) {
+                term.workReceived();
+                lock_guard lock(node.mtx);
+                for (auto &w: batch) {
+                    node.queue.push_back(std::move(w));
+                }
+                node.queued = static_cast<int>(node.queue.size());
+                node.cv.notify_all();
+            }
+        }
+
+        // Everything else that arrived
+        int flag = 0;
+        MPI_Status status;
+        MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, comm, &flag, &status);
+        while (flag && !done) {
+            busy = true;
+            const int sender = status.MPI_SOURCE;
+            switch (status.MPI_TAG) {
+                case TAG_STEAL:
+                    MPI_Recv(nullptr, 0, MPI_INT, sender, TAG_STEAL, comm, MPI_STATUS_IGNORE);
+                    thieves.push_back(sender);
+                    break;
+                case TAG_TOKEN:
+                    term.receiveToken(sender, rank);
+                    break;
+                case TAG_RESULT:
+                    // Only rank 0 receives these; the first one wins
+                    // (in Chromatic mode the coloring is picked up again by gatherResults)
+                    transport.receive(status, batch);
+                    term.workReceived();
+                    if (mode == SolveMode::First) {
+                        totals.coloring = batch.front().coloring;
+                    }
+                    terminateAll();
+                    break;
+                case TAG_TERMINATE:
+                    MPI_Recv(nullptr, 0, MPI_INT, sender, TAG_TERMINATE, comm, MPI_STATUS_IGNORE);
+                    done = true;
+                    break;
+                default: {
+                    // Unexpected, just drain it
+                    int count;
+                    MPI_Get_count(&status, MPI_BYTE, &count);
+                    vector<char> sink(count);
+                    MPI_Recv(sink.data(), count, MPI_BYTE, sender, status.MPI_TAG, comm,
+                             MPI_STATUS_IGNORE);
+                }
+            }
+            if (!done) {
+                MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, comm, &flag, &status);
+            }
+        }
+        if (done) {
+            break;
+        }
+
+        // Serve waiting thieves from the node queue. A thief gets an empty batch only once
+        // this whole rank has gone idle, otherwise the busy threads are asked to split for it.
+        bool passive;
+        {
+            lock_guard lock(node.mtx);
+            passive = node.queue.empty() && node.idle.load() == static_cast<int>(numThreads);
+            while (!thieves.empty() && (!node.queue.empty() || passive || solved)) {
+                batch.clear();
+                const size_t amount = min<size_t>(max<size_t>(node.queue.size() / 2, 1), WorkTransport::MAX_BATCH);
+                while (!solved && batch.size() < amount && !node.queue.empty()) {
+                    batch.push_back(std::move(node.queue.front()));
+                    node.queue.pop_front();
+                }
+                node.queued = static_cast<int>(node.queue.size());
+
+                transport.send(batch, thieves.front(), TAG_WORK);
+                bump(Counter::ItemsGiven, batch.size());
+                if (!batch.empty()) {
+                    term.workSent();
+                }
+                thieves.pop_front();
+                busy = true;
+            }
+            node.remoteWanted = static_cast<int>(thieves.size());
+        }
+
+        if (passive || solved) {
+            if (numProcs == 1 && !solved) {
+                break;
+            }
+            if (term.haveToken && term.passToken(rank, numProcs)) {
+                terminateAll();
+                break;
+            }
+        }
+
+        // Some of our threads are starving and nobody local has anything queued: ask another rank
+        if (numProcs > 1 && !stealPending && !solved && node.idle.load() > 0 && node.queued.load() == 0) {
+            const int victim = pickVictim(rng, rank, numProcs);
+            transport.postReceive(victim, TAG_WORK);
+            MPI_Send(nullptr, 0, MPI_INT, victim, TAG_STEAL, comm);
+            stealPending = true;
+            bump(Counter::StealAttempts);
+        }
+
+        if (!busy) {
+            // Keep the core free for the search threads while nothing is going on
+            this_thread::sleep_for(chrono::microseconds(50));
+        }
+    }
+
+    {
+        lock_guard lock(node.mtx);
+        node.stop = true;
+    }
+    node.cv.notify_all();
+    pool.wait();
+
+    drainUntilQuiet(transport, comm);
+    bound.reset();
+    if (mode != SolveMode::First) {
+        gatherResults(node.goal, node.counted, m, graph.size(), comm, totals);
+    }
+    totals.nodes = node.nodes;
+    totals.firstSolution = node.goal.firstSolutionSeconds();
+    return totals;
+}
+
+int main(int argc, char **argv) {
+    // Only the main thread makes MPI calls, so FUNNELED is all we need
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+
+    int rank, numProcs;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &numProcs);
+
+    if (provided < MPI_THREAD_FUNNELED) {
+        if (rank == 0) {
+            cerr << "The MPI library does not support MPI_THREAD_FUNNELED" << endl;
+        }
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    // number of colors, graph file, heuristics and threads per rank
+    MpiOptions options;
+    if (!parseMpiOptions(argc, argv, rank, options)) {
+        MPI_Finalize();
+        return 1;
+    }
+    if (!options.checkpointPath.empty()) {
+        // The frontier is spread over the threads' stacks and the node queue; only the MPI engine snapshots it
+        if (rank == 0) {
+            cerr << "--checkpoint is only supported by NColouringProblemMPI" << endl;
+        }
+        MPI_Finalize();
+        return 1;
+    }
+    setupGraph(options, rank);
+
+    // Leave one core to the communication thread unless told otherwise
+    unsigned numThreads = options.threads;
+    if (numThreads == 0) {
+        const unsigned cores = thread::hardware_concurrency(); // Allowed to return 0
+        numThreads = cores > 1 ? cores - 1 : 1;
+    }
+
+    setupTracing(options, rank);
+    MPI_Barrier(MPI_COMM_WORLD);
+    resetTraceOrigin();
+    const double start = MPI_Wtime();
+    const RunTotals totals = solveDecomposed(options, rank, numThreads, [&](const Graph &graph, const JobSetup &setup) {
+        const Ordering ordering(graph, options.vertexOrder, options.valueOrder);
+        return hybridCode(rank, numProcs, graph, options.m, setup.lowerBound, numThreads, ordering, options.mode,
+                          setup.nogoodBytes, setup.comm);
+    });
+    reportRun(options, "hybrid", rank, numProcs, numThreads, MPI_Wtime() - start, totals);
+
+    MPI_Finalize();
+    return 0;
+}
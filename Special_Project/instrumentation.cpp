@@ -0,0 +1,146 @@
+#include "instrumentation.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+
+thread_local WorkerStats *currentWorkerStats = nullptr;
+std::atomic<bool> traceEnabled{false};
+std::chrono::steady_clock::time_point traceOrigin = std::chrono::steady_clock::now();
+
+namespace {
+    const char *const COUNTER_NAMES[NUM_COUNTERS] = {
+        "nodes", "backtracks", "nogood_hits", "steal_attempts", "steals_empty", "items_stolen", "items_given",
+        "idle_ns", "messages_sent", "bytes_sent", "messages_received", "bytes_received"
+    };
+
+    std::mutex registryMtx;
+    std::vector<std::unique_ptr<WorkerStats> > registry; // Every slot ever made, in order
+    std::vector<WorkerStats *> released; // Slots whose thread exited
+
+    // Gives the thread's slot back when the thread exits
+    struct SlotLease {
+        WorkerStats *slot = nullptr;
+
+        ~SlotLease() {
+            if (slot) {
+                std::lock_guard lock(registryMtx);
+                released.push_back(slot);
+                currentWorkerStats = nullptr;
+            }
+        }
+    };
+
+    thread_local SlotLease lease;
+}
+
+const char *counterName(Counter counter) {
+    return COUNTER_NAMES[static_cast<int>(counter)];
+}
+
+WorkerStats *acquireWorkerStats() {
+    std::lock_guard lock(registryMtx);
+    if (!released.empty()) {
+        lease.slot = released.back();
+        released.pop_back();
+    } else {
+        registry.push_back(std::make_unique<WorkerStats>());
+        lease.slot = registry.back().get();
+        lease.slot->thread = static_cast<int>(registry.size()) - 1;
+        if (traceEnabled.load()) {
+            lease.slot->ring.resize(WorkerStats::RING_SIZE);
+        }
+    }
+    return lease.slot;
+}
+
+void enableTracing() {
+    if constexpr (INSTRUMENTED) {
+        std::lock_guard lock(registryMtx);
+        for (auto &slot: registry) {
+            slot->ring.resize(WorkerStats::RING_SIZE);
+        }
+        traceEnabled = true;
+    }
+}
+
+void resetTraceOrigin() {
+    traceOrigin = std::chrono::steady_clock::now();
+}
+
+CounterValues processCounters() {
+    CounterValues total{};
+    for (const CounterValues &values: threadCounters()) {
+        for (int c = 0; c < NUM_COUNTERS; ++c) {
+            total[c] += values[c];
+        }
+    }
+    return total;
+}
+
+std::vector<CounterValues> threadCounters() {
+    std::lock_guard lock(registryMtx);
+    std::vector<CounterValues> values;
+    for (const auto &slot: registry) {
+        values.push_back(slot->counters);
+    }
+    return values;
+}
+
+std::string describeCounters(const CounterValues &total, const CounterValues &least, const CounterValues &most,
+                             const char *worker) {
+    std::string text = std::string("Counters (total, least .. most per ") + worker + "):";
+    char line[160];
+    for (int c = 0; c < NUM_COUNTERS; ++c) {
+        std::snprintf(line, sizeof(line), "\n  %-18s %16llu  (%llu .. %llu)", COUNTER_NAMES[c], total[c], least[c],
+                      most[c]);
+        text += line;
+    }
+    return text;
+}
+
+std::string traceEventsJson(int pid, const std::string &processName) {
+    std::lock_guard lock(registryMtx);
+    std::string json = "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" + std::to_string(pid) +
+                       ",\"args\":{\"name\":\"" + processName + "\"}}";
+    char event[256];
+    for (const auto &slot: registry) {
+        std::snprintf(event, sizeof(event),
+                      ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}",
+                      pid, slot->thread, slot->thread);
+        json += event;
+
+        // Only the last RING_SIZE survived
+        const std::uint64_t written = slot->written.load(std::memory_order_acquire);
+        const std::uint64_t first = written > slot->ring.size() ? written - slot->ring.size() : 0;
+        for (std::uint64_t k = first; k < written; ++k) {
+            const WorkerStats::Event &e = slot->ring[k % slot->ring.size()];
+            // Chrome traces count in microseconds
+            if (e.duration < 0) {
+                std::snprintf(event, sizeof(event),
+                              ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d}",
+                              e.name, e.start / 1e3, pid, slot->thread);
+            } else {
+                std::snprintf(event, sizeof(event),
+                              ",\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d}",
+                              e.name, e.start / 1e3, e.duration / 1e3, pid, slot->thread);
+            }
+            json += event;
+        }
+    }
+    return json;
+}
+
+void writeTraceFile(const std::string &path, const std::vector<std::string> &processEvents) {
+    std::ofstream out(path);
+    if (!out) {
+        throw std::runtime_error("Cannot write the trace to " + path);
+    }
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    for (std::size_t p = 0; p < processEvents.size(); ++p) {
+        out << (p > 0 ? ",\n" : "") << processEvents[p];
+    }
+    out << "\n]}\n";
+}
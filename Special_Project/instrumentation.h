@@ -0,0 +1,168 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// 1 keeps the search counters and trace points below, 0 compiles every one of them out. Debug builds keep them
+// and release builds do not, unless told otherwise with -DNCOLOURING_INSTRUMENT=n (the CMake cache variable).
+#ifndef NCOLOURING_INSTRUMENT
+#ifdef NDEBUG
+#define NCOLOURING_INSTRUMENT 0
+#else
+#define NCOLOURING_INSTRUMENT 1
+#endif
+#endif
+
+constexpr bool INSTRUMENTED = NCOLOURING_INSTRUMENT != 0;
+
+// What every worker thread counts for itself
+enum class Counter {
+    Nodes,
+    Backtracks, // Frames that ran out of colors
+    NogoodHits, // States the nogood cache refuted
+    StealAttempts, // From another pool deque, or steal requests to another rank
+    StealsEmpty, // ... that came back with nothing
+    ItemsStolen, // Tasks or work items those brought in
+    ItemsGiven, // Work items handed to other ranks
+    IdleNanoseconds, // Waiting for work
+    MessagesSent, // Work batches (and results) between ranks
+    BytesSent,
+    MessagesReceived,
+    BytesReceived
+};
+constexpr int NUM_COUNTERS = 12;
+
+const char *counterName(Counter counter);
+
+using CounterValues = std::array<unsigned long long, NUM_COUNTERS>;
+
+/**
+ * One thread's counters and trace. alignas(64) puts every slot on cache lines of its own, so threads
+ * bumping their counters never invalidate each other's. A slot is taken the first time a thread counts
+ * or traces anything and handed to the next new thread once it exits, so pools that come and go per
+ * job reuse the same few slots.
+ *
+ * The trace is a ring only its own thread writes: an event goes in at `written` modulo the ring size
+ * and is published by the release store of `written`, so a reader never takes a lock and the writer
+ * never waits; once the ring is full the oldest events are overwritten.
+ */
+struct alignas(64) WorkerStats {
+    static constexpr std::size_t RING_SIZE = 1 << 14; // Events kept per thread
+
+    struct Event {
+        std::int64_t start; // Nanoseconds since the trace origin
+        std::int64_t duration; // Nanoseconds; < 0 for an instant
+        const char *name; // A string literal
+    };
+
+    CounterValues counters{};
+    int thread = 0; // Order the slots were made in: the tid in the trace
+    unsigned sampleTick = 0; // For sampled spans
+    std::vector<Event> ring; // Empty unless tracing
+    std::atomic<std::uint64_t> written{0}; // Events ever recorded
+
+    void record(std::int64_t start, std::int64_t duration, const char *name) {
+        if (ring.empty()) {
+            return;
+        }
+        const std::uint64_t next = written.load(std::memory_order_relaxed);
+        ring[next % RING_SIZE] = Event{start, duration, name};
+        written.store(next + 1, std::memory_order_release);
+    }
+};
+
+// A sampled span is only recorded once every this many times on its thread
+constexpr unsigned TRACE_SAMPLE_EVERY = 16;
+
+WorkerStats *acquireWorkerStats(); // Slot for a thread that has none yet
+extern thread_local WorkerStats *currentWorkerStats;
+extern std::atomic<bool> traceEnabled;
+extern std::chrono::steady_clock::time_point traceOrigin;
+
+inline WorkerStats &workerStats() {
+    if (!currentWorkerStats) {
+        currentWorkerStats = acquireWorkerStats();
+    }
+    return *currentWorkerStats;
+}
+
+inline void bump(Counter counter, unsigned long long amount = 1) {
+    if constexpr (INSTRUMENTED) {
+        workerStats().counters[static_cast<int>(counter)] += amount;
+    }
+}
+
+// Nanoseconds since the trace origin; 0 when compiled out
+inline std::int64_t traceNow() {
+    if constexpr (INSTRUMENTED) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - traceOrigin).count();
+    }
+    return 0;
+}
+
+// The calling thread waited for work since `start` (a traceNow()): counted, and traced as an "idle" span
+inline void recordIdle(std::int64_t start) {
+    if constexpr (INSTRUMENTED) {
+        const std::int64_t now = traceNow();
+        bump(Counter::IdleNanoseconds, static_cast<unsigned long long>(now - start));
+        if (traceEnabled.load(std::memory_order_relaxed)) {
+            workerStats().record(start, now - start, "idle");
+        }
+    }
+}
+
+inline void traceInstant(const char *name) {
+    if constexpr (INSTRUMENTED) {
+        if (traceEnabled.load(std::memory_order_relaxed)) {
+            workerStats().record(traceNow(), -1, name);
+        }
+    }
+}
+
+// Traces its own lifetime as a span named `name`. Sampled ones are for spans too frequent to keep them all.
+class ScopedSpan {
+public:
+#if NCOLOURING_INSTRUMENT
+    explicit ScopedSpan(const char *name, bool sampled = false) : name(name) {
+        if (traceEnabled.load(std::memory_order_relaxed) &&
+            (!sampled || workerStats().sampleTick++ % TRACE_SAMPLE_EVERY == 0)) {
+            start = traceNow();
+        }
+    }
+    ~ScopedSpan() {
+        if (start >= 0) {
+            workerStats().record(start, traceNow() - start, name);
+        }
+    }
+
+private:
+    const char *name;
+    std::int64_t start = -1; // Not recording
+#else
+    explicit ScopedSpan(const char *, bool = false) {
+    }
+#endif
+};
+
+// From now on every slot keeps a trace ring. Call once at startup, before the worker threads exist.
+void enableTracing();
+
+// Timestamps count from now on; the ranks of an MPI job call it together after a barrier
+void resetTraceOrigin();
+
+CounterValues processCounters(); // Summed over every slot of this process
+std::vector<CounterValues> threadCounters(); // One per slot
+
+// A few lines for the log, one per counter: the total, and the least and most one `worker` (thread or rank) had
+std::string describeCounters(const CounterValues &total, const CounterValues &least, const CounterValues &most,
+                             const char *worker);
+
+// This process's trace events as Chrome trace JSON objects, comma separated, under the given pid
+std::string traceEventsJson(int pid, const std::string &processName);
+
+// A Chrome trace / Perfetto file holding the events of every process. Throws std::runtime_error.
+void writeTraceFile(const std::string &path, const std::vector<std::string> &processEvents);
@@ -0,0 +1,291 @@
+#include "loader.h"
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <stdexcept>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+    // Read-only view of a whole file; the kernel pages it in as the parser threads touch it
+    class MappedFile {
+    public:
+        explicit MappedFile(const std::string &path) {
+            fd = open(path.c_str(), O_RDONLY);
+            if (fd < 0) {
+                throw std::runtime_error("Cannot open graph file " + path);
+            }
+
+            struct stat st{};
+            if (fstat(fd, &st) != 0) {
+                close(fd);
+                throw std::runtime_error("Cannot stat graph file " + path);
+            }
+            length = static_cast<std::size_t>(st.st_size);
+
+            if (length > 0) {
+                void *addr = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (addr == MAP_FAILED) {
+                    close(fd);
+                    throw std::runtime_error("Cannot map graph file " + path);
+                }
+                madvise(addr, length, MADV_SEQUENTIAL);
+                bytes = static_cast<const char *>(addr);
+            }
+        }
+
+        ~MappedFile() {
+            if (bytes) {
+                munmap(const_cast<char *>(bytes), length);
+            }
+            close(fd);
+        }
+
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+
+        const char *begin() const { return bytes; }
+        const char *end() const { return bytes + length; }
+        std::size_t size() const { return length; }
+
+    private:
+        int fd = -1;
+        const char *bytes = nullptr;
+        std::size_t length = 0;
+    };
+
+    struct ChunkResult {
+        std::vector<std::pair<int, int> > edges;
+        int maxVertex = -1;
+        const char *error = nullptr; // Position of the first malformed line, if any
+        bool outOfRange = false; // ... and that line is well formed, but names a vertex an int cannot hold
+    };
+
+    const char *skipBlanks(const char *p, const char *end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+            ++p;
+        }
+        return p;
+    }
+
+    const char *skipLine(const char *p, const char *end) {
+        while (p < end && *p != '\n') {
+            ++p;
+        }
+        return p < end ? p + 1 : end;
+    }
+
+    // Parses a non-negative decimal in place; no std::string, no strtol locale lookups. Anything past INT_MAX
+    // stops growing there, so callers only have to compare against that.
+    bool parseNumber(const char *&p, const char *end, long long &out) {
+        p = skipBlanks(p, end);
+        if (p == end || *p < '0' || *p > '9') {
+            return false;
+        }
+
+        out = 0;
+        while (p < end && *p >= '0' && *p <= '9') {
+            if (out <= INT_MAX) {
+                out = out * 10 + (*p - '0');
+            }
+            ++p;
+        }
+        return true;
+    }
+
+    bool isComment(char c) {
+        return c == 'c' || c == '#' || c == '%';
+    }
+
+    // Finds the "p edge <n> <m>" header, which DIMACS puts before any edge; -1 means plain edge list
+    long long dimacsVertexCount(const char *p, const char *end) {
+        while (p < end) {
+            p = skipBlanks(p, end);
+            if (p < end && *p == 'p') {
+                ++p;
+                p = skipBlanks(p, end);
+                while (p < end && *p != ' ' && *p != '\t') {
+                    ++p; // Format word: "edge", "col", ...
+                }
+
+                long long n;
+                if (!parseNumber(p, end, n)) {
+                    throw std::runtime_error("Malformed DIMACS header");
+                }
+                return n;
+            }
+            if (p < end && *p != '\n' && !isComment(*p)) {
+                return -1; // First real line is not a header
+            }
+            p = skipLine(p, end);
+        }
+        return -1;
+    }
+
+    void parseChunk(const char *p, const char *end, bool dimacs, ChunkResult &result) {
+        while (p < end) {
+            const char *line = p;
+            p = skipBlanks(p, end);
+
+            if (p == end || *p == '\n' || isComment(*p) || (dimacs && *p == 'p')) {
+                p = skipLine(p, end);
+                continue;
+            }
+            if (dimacs) {
+                if (*p != 'e') {
+                    result.error = line;
+                    return;
+                }
+                ++p;
+            }
+
+            long long u, v;
+            if (!parseNumber(p, end, u) || !parseNumber(p, end, v)) {
+                result.error = line;
+                return;
+            }
+            if (dimacs) {
+                if (u == 0 || v == 0) {
+                    result.error = line;
+                    return;
+                }
+                --u; // DIMACS counts vertices from 1
+                --v;
+            }
+            // The vertex count, and the n + 1 row offsets, have to fit an int too
+            if (u >= INT_MAX - 1 || v >= INT_MAX - 1) {
+                result.error = line;
+                result.outOfRange = true;
+                return;
+            }
+
+            if (u != v) {
+                result.edges.emplace_back(static_cast<int>(u), static_cast<int>(v));
+                result.maxVertex = std::max(result.maxVertex, static_cast<int>(std::max(u, v)));
+            }
+            p = skipLine(p, end);
+        }
+    }
+
+    template<typename Fn>
+    void parallelFor(unsigned numThreads, Fn fn) {
+        std::vector<std::thread> threads;
+        for (unsigned t = 0; t < numThreads; ++t) {
+            threads.emplace_back(fn, t);
+        }
+        for (auto &t: threads) {
+            t.join();
+        }
+    }
+}
+
+CsrGraph loadCsr(const std::string &path, unsigned numThreads) {
+    if (numThreads == 0) {
+        numThreads = 1;
+    }
+
+    MappedFile file(path);
+    const long long declared = dimacsVertexCount(file.begin(), file.end());
+    const bool dimacs = declared >= 0;
+    if (declared >= INT_MAX) {
+        throw std::runtime_error("DIMACS header of " + path + " declares more vertices than supported");
+    }
+
+    // Cut the file into one chunk per thread, moving every cut forward to the next line start
+    std::vector<const char *> cuts(numThreads + 1);
+    for (unsigned t = 0; t <= numThreads; ++t) {
+        const char *p = file.begin() + file.size() * t / numThreads;
+        while (t > 0 && p < file.end() && p[-1] != '\n') {
+            ++p;
+        }
+        cuts[t] = p;
+    }
+
+    std::vector<ChunkResult> chunks(numThreads);
+    parallelFor(numThreads, [&](unsigned t) {
+        parseChunk(cuts[t], cuts[t + 1], dimacs, chunks[t]);
+    });
+
+    int maxVertex = -1;
+    for (const auto &chunk: chunks) {
+        if (chunk.error) {
+            const long long offset = chunk.error - file.begin();
+            throw std::runtime_error((chunk.outOfRange ? "Vertex id out of range at byte " : "Malformed line at byte ") +
+                                     std::to_string(offset) + " of " + path);
+        }
+        maxVertex = std::max(maxVertex, chunk.maxVertex);
+    }
+
+    CsrGraph csr;
+    csr.n = dimacs ? static_cast<int>(declared) : maxVertex + 1;
+    if (maxVertex >= csr.n) {
+        throw std::runtime_error("Edge endpoint " + std::to_string(maxVertex + 1) + " exceeds the DIMACS header in " +
+                                 path);
+    }
+
+    // Degree count and scatter run on the same threads that parsed the chunks
+    std::vector<long long> degree(csr.n, 0);
+    parallelFor(numThreads, [&](unsigned t) {
+        for (const auto &[u, v]: chunks[t].edges) {
+            std::atomic_ref(degree[u]).fetch_add(1, std::memory_order_relaxed);
+            std::atomic_ref(degree[v]).fetch_add(1, std::memory_order_relaxed);
+        }
+    });
+
+    csr.offsets.assign(csr.n + 1, 0);
+    for (int v = 0; v < csr.n; ++v) {
+        csr.offsets[v + 1] = csr.offsets[v] + degree[v];
+    }
+    csr.targets.resize(csr.offsets[csr.n]);
+
+    std::vector<long long> cursor(csr.offsets.begin(), csr.offsets.end() - 1);
+    parallelFor(numThreads, [&](unsigned t) {
+        for (const auto &[u, v]: chunks[t].edges) {
+            csr.targets[std::atomic_ref(cursor[u]).fetch_add(1, std::memory_order_relaxed)] = v;
+            csr.targets[std::atomic_ref(cursor[v]).fetch_add(1, std::memory_order_relaxed)] = u;
+        }
+        chunks[t].edges = {}; // Give the memory back before the next pass
+    });
+
+    // Sort each row and drop duplicate edges; rows are independent so threads take vertex ranges
+    parallelFor(numThreads, [&](unsigned t) {
+        const int from = static_cast<int>(static_cast<long long>(csr.n) * t / numThreads);
+        const int to = static_cast<int>(static_cast<long long>(csr.n) * (t + 1) / numThreads);
+        for (int v = from; v < to; ++v) {
+            auto first = csr.targets.begin() + csr.offsets[v];
+            auto last = csr.targets.begin() + csr.offsets[v + 1];
+            std::sort(first, last);
+            degree[v] = std::unique(first, last) - first;
+        }
+    });
+
+    // Squeeze the gaps left by duplicates out of the target array
+    long long write = 0;
+    for (int v = 0; v < csr.n; ++v) {
+        const long long read = csr.offsets[v];
+        std::copy(csr.targets.begin() + read, csr.targets.begin() + read + degree[v], csr.targets.begin() + write);
+        csr.offsets[v] = write;
+        write += degree[v];
+    }
+    csr.offsets[csr.n] = write;
+    csr.targets.resize(write);
+
+    return csr;
+}
+
+Graph toGraph(const CsrGraph &csr) {
+    // The rows are sorted and free of duplicates already, so they become the neighbour lists as they are
+    std::vector<std::vector<int> > lists(csr.n);
+    for (int v = 0; v < csr.n; ++v) {
+        lists[v].assign(csr.targets.begin() + csr.offsets[v], csr.targets.begin() + csr.offsets[v + 1]);
+    }
+    return Graph(std::move(lists));
+}
+
+Graph loadGraph(const std::string &path, unsigned numThreads) {
+    return toGraph(loadCsr(path, numThreads));
+}
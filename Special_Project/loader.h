@@ -0,0 +1,34 @@
+#pragma once
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "graph.h"
+
+/**
+ * Compressed sparse row graph: the neighbours of v are targets[offsets[v] .. offsets[v + 1]).
+ * Every undirected edge is stored in both directions, rows are sorted and free of duplicates.
+ */
+struct CsrGraph {
+    int n = 0;
+    std::vector<long long> offsets{0};
+    std::vector<int> targets;
+
+    long long edgeCount() const { return static_cast<long long>(targets.size()) / 2; }
+};
+
+/**
+ * Loads a graph straight from a memory-mapped file, parsing it in parallel chunks.
+ *
+ * Two formats are understood, and told apart by the presence of a "p" line:
+ *  - DIMACS .col: "c ..." comments, one "p edge <n> <m>" header, "e <u> <v>" edges, 1-based
+ *  - plain edge list: one "<u> <v>" pair per line, 0-based, '#' and '%' start comments
+ *
+ * Throws std::runtime_error when the file cannot be mapped or is malformed.
+ */
+CsrGraph loadCsr(const std::string &path, unsigned numThreads = std::thread::hardware_concurrency());
+
+// Same as loadCsr, then turned into the Graph the solvers search on
+Graph loadGraph(const std::string &path, unsigned numThreads = std::thread::hardware_concurrency());
+
+Graph toGraph(const CsrGraph &csr); // O(n + m): the rows are copied over as they are
@@ -0,0 +1,157 @@
+#include "local_search.h"
+#include "instrumentation.h"
+
+LocalSearch::LocalSearch(const Graph &graph, int m, const Ordering &ordering, SearchGoal &goal) : state(graph, m),
+    ordering(&ordering), goal(&goal) {
+}
+
+void LocalSearch::push(WorkItem item) {
+    pending.push_back(std::move(item));
+}
+
+bool LocalSearch::open() {
+    // Refuted before, maybe with the colors renamed (or a stolen item somebody already searched): a dead end
+    if (goal->knownDead(state)) {
+        if (!frames.empty()) {
+            state.undo();
+        }
+        return false;
+    }
+
+    const int v = ordering->nextVertex(state);
+    if (v < 0) {
+        if (goal->complete(state, count)) {
+            found = state.coloring();
+            return true;
+        }
+        // Keep going: back out of the leaf as if it had failed (a root item has nothing to undo)
+        if (!frames.empty()) {
+            state.undo();
+        }
+        return false;
+    }
+
+    int ordered[SearchState::MAX_COLORS];
+    const int colors = ordering->orderColors(state, v, ordered, goal->colorLimit(state));
+    frames.push_back({v, choices.size(), choices.size(), choices.size() + colors, explored, count.classes, true});
+    choices.insert(choices.end(), ordered, ordered + colors);
+    return false;
+}
+
+bool LocalSearch::start() {
+    root = std::move(pending.back());
+    pending.pop_back();
+    ++explored;
+
+    if (!state.reset(root.coloring.data())) {
+        return false; // Dead on arrival, nothing to search
+    }
+    return open();
+}
+
+bool LocalSearch::run(long long budget) {
+    ScopedSpan span("search", true);
+    while (budget > 0) {
+        if (frames.empty()) {
+            if (pending.empty()) {
+                return false;
+            }
+            if (start()) {
+                return true;
+            }
+            continue;
+        }
+
+        Frame &frame = frames.back();
+        if (frame.next == frame.end) {
+            // Every color failed here: remember it if that took a while, drop the frame and undo the color
+            // its parent was trying
+            if (frame.whole && explored - frame.nodesBefore >= SearchGoal::MIN_NOGOOD_NODES &&
+                count.classes == frame.countedBefore) {
+                goal->recordDead(state);
+            }
+            choices.resize(frame.begin);
+            frames.pop_back();
+            ++backtracked;
+            if (!frames.empty()) {
+                state.undo();
+            }
+            continue;
+        }
+
+        const int c = choices[frame.next++];
+        // The incumbent may have improved since this frame was opened
+        if (c > goal->colorLimit(state)) {
+            continue;
+        }
+        // A neighbour that lost its last color makes this branch dead: skip it without descending
+        if (!state.assign(frame.vertex, c)) {
+            state.undo();
+            continue;
+        }
+
+        ++explored;
+        --budget;
+        if (open()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool LocalSearch::split(WorkItem &out) {
+    // Whole subproblems nobody has touched yet are the cheapest thing to give away
+    if (!pending.empty()) {
+        out = std::move(pending.front());
+        pending.pop_front();
+        return true;
+    }
+
+    for (std::size_t i = 0; i < frames.size(); ++i) {
+        Frame &frame = frames[i];
+        if (frame.next == frame.end) {
+            continue;
+        }
+
+        // The branch is the root item plus the colors currently on the path above frame i
+        out.coloring = root.coloring;
+        for (std::size_t j = 0; j < i; ++j) {
+            out.coloring[frames[j].vertex] = state.color(frames[j].vertex);
+        }
+        out.coloring[frame.vertex] = choices[--frame.end];
+        // Part of the subtree of every frame from here up is somebody else's now
+        for (std::size_t j = 0; j <= i; ++j) {
+            frames[j].whole = false;
+        }
+        out.depth = root.depth + static_cast<int>(i) + 1;
+        return true;
+    }
+    return false;
+}
+
+std::size_t LocalSearch::spare() const {
+    std::size_t count = pending.size();
+    for (const Frame &frame: frames) {
+        count += frame.end - frame.next;
+    }
+    return count;
+}
+
+void LocalSearch::frontier(std::vector<WorkItem> &out) const {
+    out.insert(out.end(), pending.begin(), pending.end());
+
+    // The branch currently on the path is covered by the untried ones of the frames below it
+    std::vector<int> path = root.coloring;
+    for (std::size_t i = 0; i < frames.size(); ++i) {
+        const Frame &frame = frames[i];
+        for (std::size_t k = frame.next; k < frame.end; ++k) {
+            // Cut by the incumbent, run() would skip it anyway
+            if (choices[k] >= goal->boundColors()) {
+                continue;
+            }
+            path[frame.vertex] = choices[k];
+            out.push_back(WorkItem{path, root.depth + static_cast<int>(i) + 1});
+        }
+        path[frame.vertex] = state.color(frame.vertex);
+    }
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <deque>
+#include <vector>
+
+#include "graph.h"
+#include "ordering.h"
+#include "search_goal.h"
+#include "search_state.h"
+
+/**
+ * A struct to represent a "partial job" or state:
+ *  - 'coloring': partial color assignment (0 = uncolored)
+ *  - 'depth': how many vertices are already colored. Which vertex comes next is up to the
+ *    vertex ordering (see ordering.h), so it is not necessarily vertex number `depth`.
+ */
+struct WorkItem {
+    std::vector<int> coloring;
+    int depth;
+};
+
+/**
+ * Depth-first search that can be paused and split, for engines that share work between
+ * processes. run() explores a bounded number of nodes and returns, so the caller can service
+ * messages in between. split() hands out the untried branch closest to the root, which is
+ * the largest piece of work this searcher can give away without disturbing its own path.
+ * Full colorings go to the shared SearchGoal, which decides whether the search stops there;
+ * subtrees that ran dry without anything split off are reported to its nogood cache.
+ */
+class LocalSearch {
+public:
+    LocalSearch(const Graph &graph, int m, const Ordering &ordering, SearchGoal &goal);
+
+    void push(WorkItem item); // Queue a subproblem to be searched after the current one
+    bool hasWork() const { return !frames.empty() || !pending.empty(); }
+
+    // Explore up to `budget` nodes. Returns true as soon as the goal is met (see solution()): the
+    // first full coloring, or in Chromatic mode one that hits the lower bound. Count mode never stops early.
+    bool run(long long budget);
+
+    bool split(WorkItem &out); // False when there is nothing left to give away
+    std::size_t spare() const; // How many items split() could hand out right now
+
+    // Appends everything still to search to `out` without disturbing the search: the pending items and
+    // every untried branch, as split() would hand them out. Searching all of them covers exactly what
+    // run() has left (a checkpoint, see checkpoint.h).
+    void frontier(std::vector<WorkItem> &out) const;
+
+    const std::vector<int> &solution() const { return found; }
+    const SolutionCount &counted() const { return count; }
+    long long nodes() const { return explored; }
+    long long backtracks() const { return backtracked; } // Frames that ran out of colors
+
+private:
+    struct Frame {
+        int vertex;
+        std::size_t begin; // This frame's candidate colors are choices[begin .. end)
+        std::size_t next; // Next of them to try
+        std::size_t end; // split() gives colors away from the back
+        long long nodesBefore; // explored when it was opened
+        unsigned long long countedBefore; // count.classes when it was opened
+        bool whole; // Nothing was given away by split(), so when it runs dry its subtree is done
+    };
+
+    bool open(); // Push a frame for the next vertex; true when there is none left and the goal is met
+    bool start(); // Begin the next pending subproblem; true if it is already a solution
+
+    SearchState state;
+    const Ordering *ordering;
+    SearchGoal *goal;
+
+    WorkItem root; // Subproblem the current frames descend from
+    std::vector<Frame> frames;
+    std::vector<int> choices;
+    std::deque<WorkItem> pending; // Own work runs from the back, split() gives from the front
+
+    std::vector<int> found;
+    SolutionCount count;
+    long long explored = 0;
+    long long backtracked = 0;
+};
@@ -1,85 +1,526 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <condition_variable>
 #include <mutex>
+#include <numeric>
+#include <optional>
+#include <stdexcept>
+#include <stop_token>
+#include <string>
 #include <thread>
+#include <vector>
+
+#include "benchmark.h"
+#include "decomposition.h"
+#include "generators.h"
+#include "graph.h"
+#include "instrumentation.h"
+#include "loader.h"
+#include "ordering.h"
+#include "search_goal.h"
+#include "search_state.h"
+#include "thread_pool.h"
 
 using namespace std;
 
 
-#define V 4
-std::mutex mtx;
-bool foundSol = false;
+using Coloring = std::vector<int>; // color[v] for every vertex, 0 = not colored yet
+
+/**
+ * Hands the coloring from the worker that met the goal to the main thread without a lock.
+ * The first worker to claim the slot copies its coloring in and publishes it with a release
+ * store; any later one finds it taken and simply stops. Main reads it once the pool is done.
+ */
+class SolutionSlot {
+public:
+    bool publish(const Coloring &color) {
+        int expected = EMPTY;
+        if (!slotState.compare_exchange_strong(expected, WRITING, std::memory_order_acquire)) {
+            return false;
+        }
+        coloring = color;
+        slotState.store(READY, std::memory_order_release);
+        return true;
+    }
+
+    bool ready() const { return slotState.load(std::memory_order_acquire) == READY; }
+    const Coloring &get() const { return coloring; } // Only after ready()
+
+    // Empty again for the next job; only while no worker is running
+    void clear() {
+        coloring.clear();
+        slotState.store(EMPTY, std::memory_order_relaxed);
+    }
+
+private:
+    enum { EMPTY, WRITING, READY };
+    std::atomic<int> slotState{EMPTY};
+    Coloring coloring;
+};
+
+// Stopped by the worker that meets the goal, or by the timer. The pool drops its queued tasks on it.
+// These four are set up afresh for every job (see searchJob()).
+std::stop_source searchStop;
+// The same request as a plain flag: workers poll it on every node with a relaxed load, no lock and no fence
+std::atomic<bool> stopRequested{false};
+SolutionSlot solution;
+std::atomic<long long> nodesExplored{0};
+
+struct SolverConfig {
+    int m = 0; // Number of colors; 0 = 3, or in Chromatic mode max degree + 1 (always enough)
+    unsigned numThreads = std::thread::hardware_concurrency(); // Pool size, one worker per core by default
+    int depthCutoff = 2; // Nodes with fewer colored vertices become pool tasks, the rest is plain sequential DFS
+    std::string graphPath; // DIMACS .col or edge list; empty means the built-in example
+    std::string generate; // Generator spec (see generators.h), used instead of a file
+    VertexOrder vertexOrder = VertexOrder::Dsatur;
+    ValueOrder valueOrder = ValueOrder::Index;
+    SolveMode mode = SolveMode::First;
+    std::size_t nogoodMegabytes = 32; // Shared nogood cache, 0 = none
+    bool decompose = true; // Peel and split the graph into cores first (see decomposition.h); never in Count mode
+    double timeout = 0; // Seconds before the search gives up, 0 = none
+    std::string csvPath; // Append the run's numbers to this benchmark CSV (see benchmark.h)
+    std::string series; // Weak-scaling series the run belongs to
+    std::string tracePath; // Chrome trace of the run (see instrumentation.h), empty = none
+};
+
+void printSolution(const Coloring &color);
 
-void printSolution(int color[]);
+// Sequential backtracking below the depth cutoff. The search state is colored in place and every
+// step is undone on the way back; the explicit stack keeps deep graphs off the call stack.
+// Full colorings go to the goal; Count and Chromatic mode keep searching after one.
+void graphColoringUtil(SearchState &state, const Ordering &ordering, SearchGoal &goal, long long &nodes,
+                       long long &backtracks, SolutionCount &count) {
+    struct Frame {
+        int vertex;
+        std::size_t begin; // This frame's candidate colors are choices[begin ..]
+        std::size_t next; // Next of them to try
+        long long nodesBefore; // To tell whether its subtree was big enough to remember as a nogood
+        unsigned long long countedBefore; // And whether anything was counted below it
+    };
+
+    std::vector<Frame> frames;
+    std::vector<int> choices; // Candidate colors of every open frame, in the order they are tried
+    int ordered[SearchState::MAX_COLORS];
 
-bool isSafe(const int outgoing_vertex, bool graph[V][V], const int color[], const int c) {
-    for (int i = 0; i < V; i++) {
-        if (graph[outgoing_vertex][i] && c == color[i]) {
+    // Opens a frame for the next vertex, or hands the coloring to the goal once every vertex has a color.
+    // Returns false when the search is over (this or another worker met the goal).
+    auto descend = [&]() -> bool {
+        ++nodes;
+        if (stopRequested.load(std::memory_order_relaxed)) {
             return false;
         }
+
+        // Refuted before, maybe with the colors renamed: same as a dead end
+        if (goal.knownDead(state)) {
+            if (!frames.empty()) {
+                state.undo();
+            }
+            return true;
+        }
+
+        const int v = ordering.nextVertex(state);
+        if (v < 0) {
+            if (goal.complete(state, count)) {
+                solution.publish(state.coloring());
+                searchStop.request_stop(); // Everybody stops
+                return false;
+            }
+            // Keep going: back out of the leaf as if it had failed (a task's root has nothing to undo)
+            if (!frames.empty()) {
+                state.undo();
+            }
+            return true;
+        }
+
+        const int colors = ordering.orderColors(state, v, ordered, goal.colorLimit(state));
+        frames.push_back({v, choices.size(), choices.size(), nodes, count.classes});
+        choices.insert(choices.end(), ordered, ordered + colors);
+        return true;
+    };
+
+    if (!descend()) {
+        return;
     }
-    return true;
-}
 
-void graphColoringUtil(bool graph[V][V], const int m, int color[], const int outgoing_vertex) { {
-        std::lock_guard lock(mtx); // Lock when accessing shared variable
-        if (foundSol) {
+    while (!frames.empty()) {
+        Frame &frame = frames.back();
+
+        if (frame.next == choices.size()) {
+            // Every color failed here: remember it if that took a while, drop the frame and undo the color
+            // its parent was trying
+            if (nodes - frame.nodesBefore >= SearchGoal::MIN_NOGOOD_NODES && count.classes == frame.countedBefore) {
+                goal.recordDead(state);
+            }
+            choices.resize(frame.begin);
+            frames.pop_back();
+            ++backtracks;
+            if (!frames.empty()) {
+                state.undo();
+            }
+            continue;
+        }
+
+        const int c = choices[frame.next++];
+        // The incumbent may have improved since this frame was opened
+        if (c > goal.colorLimit(state)) {
+            continue;
+        }
+        // A neighbour that lost its last color makes this branch dead: skip it without descending
+        if (!state.assign(frame.vertex, c)) {
+            state.undo();
+            continue;
+        }
+        if (!descend()) {
             return;
         }
     }
+}
 
-    if (outgoing_vertex == V) {
-        std::lock_guard lock(mtx); // Lock when accessing shared variable
-        foundSol = true; // Mark solution found
-        printSolution(color); // Print solution
-        return;
-    }
+// Above the depth cutoff every viable color becomes its own task, so idle workers have something to steal
+// Each worker adds its Count mode tallies to its own slot, once per task
+void spawnColoringTask(ThreadPool &pool, std::vector<SearchState> &states, std::vector<SolutionCount> &counts,
+                       const Ordering &ordering, SearchGoal &goal, const SolverConfig &config, Coloring color) {
+    pool.submit([&pool, &states, &counts, &ordering, &goal, &config, color = std::move(color)]() mutable {
+        ScopedSpan span("task", true);
+        long long nodes = 0;
+        const unsigned worker = ThreadPool::currentWorker();
+        SearchState &state = states[worker]; // One state per worker, reused across tasks
+
+        if (stopRequested.load(std::memory_order_relaxed) || !state.reset(color.data())) {
+            return;
+        }
 
-    std::vector<std::thread> threads;
+        const int v = ordering.nextVertex(state);
+        if (state.coloredCount() >= config.depthCutoff || v < 0) {
+            SolutionCount count;
+            long long backtracks = 0;
+            graphColoringUtil(state, ordering, goal, nodes, backtracks, count);
+            counts[worker] += count;
+            nodesExplored.fetch_add(nodes, std::memory_order_relaxed);
+            bump(Counter::Nodes, nodes);
+            bump(Counter::Backtracks, backtracks);
+            return;
+        }
 
-    for (int i = 1; i <= m; ++i) {
-        if (isSafe(outgoing_vertex, graph, color, i)) {
-            threads.emplace_back([=]() mutable {
-                // Capture `i` by value
-                int thread_bounded_color[V]; // Create a copy of the color array
-                for (int j = 0; j < V; ++j) {
-                    thread_bounded_color[j] = color[j];
+        nodesExplored.fetch_add(1, std::memory_order_relaxed);
+        bump(Counter::Nodes);
+
+        int ordered[SearchState::MAX_COLORS];
+        const int count = ordering.orderColors(state, v, ordered, goal.colorLimit(state));
+        // Submit in reverse: the worker pops its own deque LIFO, so the preferred color runs first
+        for (int k = count - 1; k >= 0; --k) {
+            const bool alive = state.assign(v, ordered[k]);
+            state.undo();
+            if (alive) {
+                Coloring child = color; // Only the tasks near the root pay for a copy
+                child[v] = ordered[k];
+                spawnColoringTask(pool, states, counts, ordering, goal, config, std::move(child));
+            }
+        }
+    });
+}
+
+// What one job (the whole graph, or one core of it) came back with
+struct JobOutcome {
+    Coloring coloring; // First mode: the coloring found; Chromatic mode: the incumbent. Empty if none.
+    SolutionCount count;
+    long long nodes = 0;
+    double firstSolution = -1; // Seconds into the job
+    bool timedOut = false;
+};
+
+// Runs the pool on one graph until the goal is met, the search runs out or `timeout` seconds (0 = none) pass
+JobOutcome searchJob(const Graph &graph, const SolverConfig &config, int lowerBound, std::size_t nogoodBytes,
+                     double timeout) {
+    ScopedSpan span("core"); // On the main thread's line of the trace
+    searchStop = std::stop_source();
+    stopRequested = false;
+    solution.clear();
+    nodesExplored = 0;
+
+    Coloring color(graph.size(), 0); // Initialize all the colors of the vertices as 0
+
+    std::vector<SearchState> states(config.numThreads, SearchState(graph, config.m));
+    std::vector<SolutionCount> counts(config.numThreads);
+    const Ordering ordering(graph, config.vertexOrder, config.valueOrder);
+    SearchGoal goal(config.mode, config.m, lowerBound, nogoodBytes);
+
+    std::stop_callback mirror(searchStop.get_token(), [] { stopRequested.store(true, std::memory_order_relaxed); });
+    std::atomic<bool> timedOut{false};
+
+    {
+        // Sleeps until the deadline, unless the search finishes first and stops it
+        std::jthread timer;
+        if (timeout > 0) {
+            timer = std::jthread([timeout, &timedOut](std::stop_token finished) {
+                std::mutex timerMtx;
+                std::condition_variable_any timerCv;
+                std::unique_lock lock(timerMtx);
+                timerCv.wait_for(lock, finished, std::chrono::duration<double>(timeout), [] { return false; });
+                if (!finished.stop_requested()) {
+                    timedOut = true;
+                    searchStop.request_stop();
                 }
-                thread_bounded_color[outgoing_vertex] = i;
-                graphColoringUtil(graph, m, thread_bounded_color, outgoing_vertex + 1);
             });
         }
+
+        ThreadPool pool(config.numThreads, searchStop.get_token());
+        spawnColoringTask(pool, states, counts, ordering, goal, config, color);
+        pool.wait();
     }
 
-    // Join all threads
-    for (auto &t: threads) {
-        t.join(); // Wait for all spawned threads to finish
+    JobOutcome outcome;
+    if (config.mode == SolveMode::First) {
+        if (solution.ready()) {
+            outcome.coloring = solution.get();
+        }
+    } else if (config.mode == SolveMode::Chromatic) {
+        outcome.coloring = goal.incumbent();
     }
+    for (const SolutionCount &count: counts) {
+        outcome.count += count;
+    }
+    outcome.nodes = nodesExplored.load();
+    outcome.firstSolution = goal.firstSolutionSeconds();
+    outcome.timedOut = timedOut;
+    return outcome;
 }
 
-void nGraphColoringProblem(bool graph[V][V], const int m) {
-    int color[V] = {0}; // Initialize all the colors of the vertices as 0
+void nGraphColoringProblem(const Graph &graph, const SolverConfig &config) {
+    const int lowerBound = greedyCliqueSize(graph);
+    const auto start = std::chrono::steady_clock::now();
+    const auto elapsed = [&start] {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    // Count mode needs every coloring of the peeled vertices too, so it always searches the whole graph
+    Decomposition parts;
+    if (graph.size() == 0 && config.mode != SolveMode::Count) {
+        // No cores at all: the empty coloring is complete and uses no colors
+    } else if (config.decompose && config.mode != SolveMode::Count) {
+        const int k = config.mode == SolveMode::Chromatic ? lowerBound : config.m;
+        parts = decompose(graph, k, config.numThreads);
+        std::cout << describeDecomposition(parts, k) << std::endl;
+    } else {
+        parts.cores.emplace_back(graph.size());
+        std::iota(parts.cores.front().begin(), parts.cores.front().end(), 0);
+    }
+
+    // One job per core, largest first, each on the whole pool. In Chromatic mode every core only has
+    // to reach the colors an earlier one needed, which is all the whole graph will need anyway.
+    Coloring color(graph.size(), 0);
+    SolutionCount total;
+    long long nodes = 0;
+    double firstSolution = -1;
+    bool timedOut = false;
+    std::size_t solved = 0; // Cores colored so far
+    int lower = lowerBound;
+    for (const std::vector<int> &core: parts.cores) {
+        Graph sub;
+        const Graph *jobGraph = &graph;
+        if (static_cast<int>(core.size()) < graph.size()) {
+            sub = inducedSubgraph(graph, core);
+            jobGraph = &sub;
+        }
+
+        const double jobStart = elapsed();
+        const double remaining = config.timeout > 0 ? std::max(config.timeout - jobStart, 1e-3) : 0;
+        const JobOutcome job = searchJob(*jobGraph, config, lower,
+                                         coreNogoodBytes(config.nogoodMegabytes << 20, core.size()), remaining);
+        nodes += job.nodes;
+        total += job.count;
+        // The whole graph has a coloring once the last core got its first one
+        firstSolution = job.firstSolution < 0 ? -1 : jobStart + job.firstSolution;
+
+        if (!job.coloring.empty()) {
+            placeCore(core, job.coloring, color);
+            lower = std::max(lower, *std::max_element(job.coloring.begin(), job.coloring.end()));
+            ++solved;
+        }
+        if (job.timedOut) {
+            timedOut = true;
+            break;
+        }
+        if (job.coloring.empty()) {
+            break; // Count mode's one job, or a core that cannot be colored
+        }
+    }
+
+    const bool colored = config.mode != SolveMode::Count && solved == parts.cores.size();
+    if (colored) {
+        colorPeeled(graph, parts.peeled, color);
+        if (firstSolution < 0) {
+            firstSolution = elapsed(); // Nothing was left to search
+        }
+    }
+    const double seconds = elapsed();
+
+    std::string result = timedOut ? "timeout" : "none"; // For the benchmark CSV
+    if (timedOut) {
+        std::cout << "Timed out after " << config.timeout << "s, the results below are partial" << std::endl;
+    }
+    const int used = colored && !color.empty() ? *std::max_element(color.begin(), color.end()) : 0;
+    if (config.mode == SolveMode::First) {
+        if (colored) {
+            result = "colorable";
+            printSolution(color);
+        } else if (!timedOut) {
+            std::cout << "Solution does not exist" << std::endl;
+        }
+    } else if (config.mode == SolveMode::Count) {
+        if (!timedOut) {
+            result = "colorings=" + std::to_string(total.colorings);
+        }
+        std::cout << "Found " << total.colorings << " colorings with at most " << config.m << " colors ("
+                << total.classes << " up to renaming the colors)" << std::endl;
+    } else if (!colored) {
+        if (!timedOut) {
+            std::cout << "No coloring with at most " << config.m << " colors exists" << std::endl;
+        }
+    } else if (timedOut) {
+        std::cout << "Best coloring so far uses " << used << " colors" << std::endl;
+        printSolution(color);
+    } else {
+        // Every core either ran out (nothing smaller exists) or matched the clique or an earlier core
+        result = "chromatic=" + std::to_string(used);
+        std::cout << "Chromatic number is " << used << std::endl;
+        printSolution(color);
+    }
 
-    graphColoringUtil(graph, m, color, 0);
+    std::cout << "Explored " << nodes << " nodes in " << seconds << "s on " << config.numThreads << " threads ("
+            << (seconds > 0 ? nodes / seconds : 0) << " nodes/s)" << std::endl;
 
-    if (!foundSol) {
-        std::cout << "Solution does not exist" << std::endl;
+    if constexpr (INSTRUMENTED) {
+        // The spread is over the threads that counted anything at all
+        CounterValues least{}, most{};
+        least.fill(~0ULL);
+        for (const CounterValues &values: threadCounters()) {
+            if (values == CounterValues{}) {
+                continue;
+            }
+            for (int c = 0; c < NUM_COUNTERS; ++c) {
+                least[c] = std::min(least[c], values[c]);
+                most[c] = std::max(most[c], values[c]);
+            }
+        }
+        if (least[0] == ~0ULL) {
+            least.fill(0);
+        }
+        std::cout << describeCounters(processCounters(), least, most, "thread") << std::endl;
+    }
+    if (!config.tracePath.empty()) {
+        try {
+            writeTraceFile(config.tracePath, {traceEventsJson(0, "threads")});
+        } catch (const std::exception &e) {
+            std::cerr << e.what() << std::endl;
+        }
+    }
+
+    if (!config.csvPath.empty()) {
+        BenchmarkRow row;
+        row.engine = "threads";
+        row.graph = !config.generate.empty() ? config.generate : !config.graphPath.empty() ? config.graphPath : "example";
+        row.series = config.series;
+        row.vertices = graph.size();
+        row.edges = graph.edgeCount();
+        row.threads = static_cast<int>(config.numThreads);
+        row.mode = solveModeName(config.mode);
+        row.colors = config.m;
+        row.seconds = seconds;
+        row.nodes = nodes;
+        row.firstSolution = firstSolution;
+        row.result = result;
+        try {
+            appendBenchmarkRow(config.csvPath, row);
+        } catch (const std::exception &e) {
+            std::cerr << e.what() << std::endl;
+        }
     }
 }
 
 /* A utility function to print solution */
-void printSolution(int color[]) {
+void printSolution(const Coloring &color) {
     std::cout << "Solution Exists:\n";
 
-    for (int i = 0; i < V; i++) {
+    for (int i = 0; i < static_cast<int>(color.size()); i++) {
         std::cout << "\tFor vertex " << i << " color is " << color[i] << "\n";
     }
 
     std::cout << "\n";
 }
 
+// Usage: NColouringProblem [--graph file | --generate spec] [--colors m] [--threads n] [--cutoff depth]
+//                          [--order index|degree|smallest-last|dsatur] [--values index|lcv]
+//                          [--mode first|count|chromatic] [--nogoods megabytes] [--decompose 0|1]
+//                          [--timeout seconds] [--csv file] [--series name] [--trace file]
+// Returns nullopt, after saying why, if --colors is out of range
+std::optional<SolverConfig> parseArgs(int argc, char **argv) {
+    SolverConfig config;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!strcmp(argv[i], "--colors")) {
+            config.m = atoi(argv[i + 1]);
+            if (config.m < 1 || config.m > SearchState::MAX_COLORS) {
+                std::cerr << "--colors must be between 1 and " << SearchState::MAX_COLORS << std::endl;
+                return std::nullopt;
+            }
+        } else if (!strcmp(argv[i], "--threads")) {
+            config.numThreads = static_cast<unsigned>(atoi(argv[i + 1]));
+        } else if (!strcmp(argv[i], "--cutoff")) {
+            config.depthCutoff = atoi(argv[i + 1]);
+        } else if (!strcmp(argv[i], "--graph")) {
+            config.graphPath = argv[i + 1];
+        } else if (!strcmp(argv[i], "--generate")) {
+            config.generate = argv[i + 1];
+        } else if (!strcmp(argv[i], "--csv")) {
+            config.csvPath = argv[i + 1];
+        } else if (!strcmp(argv[i], "--series")) {
+            config.series = argv[i + 1];
+        } else if (!strcmp(argv[i], "--trace")) {
+            config.tracePath = argv[i + 1];
+        } else if (!strcmp(argv[i], "--order")) {
+            if (!parseVertexOrder(argv[i + 1], config.vertexOrder)) {
+                std::cerr << "Unknown vertex order " << argv[i + 1] << std::endl;
+            }
+        } else if (!strcmp(argv[i], "--values")) {
+            if (!parseValueOrder(argv[i + 1], config.valueOrder)) {
+                std::cerr << "Unknown value order " << argv[i + 1] << std::endl;
+            }
+        } else if (!strcmp(argv[i], "--nogoods")) {
+            config.nogoodMegabytes = static_cast<std::size_t>(atoi(argv[i + 1]));
+        } else if (!strcmp(argv[i], "--decompose")) {
+            config.decompose = atoi(argv[i + 1]) != 0;
+        } else if (!strcmp(argv[i], "--timeout")) {
+            config.timeout = atof(argv[i + 1]);
+        } else if (!strcmp(argv[i], "--mode")) {
+            if (!parseSolveMode(argv[i + 1], config.mode)) {
+                std::cerr << "Unknown mode " << argv[i + 1] << std::endl;
+            }
+        } else {
+            std::cerr << "Unknown option " << argv[i] << std::endl;
+        }
+    }
+
+    if (config.numThreads == 0) {
+        config.numThreads = 1;
+    }
+    return config;
+}
+
 // Driver code
-int main() {
-    /* Create following graph and test
+int main(int argc, char **argv) {
+    // Number of colors defaults to 3, the pool to one worker per core
+    const auto parsed = parseArgs(argc, argv);
+    if (!parsed) {
+        return 1;
+    }
+    SolverConfig config = *parsed;
+
+    /* Without --graph, create following graph and test
        whether it is 3 colorable
       (3)---(2)
        |   / |
@@ -87,17 +528,47 @@ int main() {
        | /   |
       (0)---(1)
     */
-    bool graph[V][V] = {
-        {0, 1, 1, 1},
-        {1, 0, 1, 0},
-        {1, 1, 0, 1},
-        {1, 0, 1, 0},
-    };
+    Graph graph(4);
+    graph.addEdge(0, 1);
+    graph.addEdge(0, 2);
+    graph.addEdge(0, 3);
+    graph.addEdge(1, 2);
+    graph.addEdge(2, 3);
 
-    // Number of colors
-    int m = 3;
+    if (!config.generate.empty()) {
+        try {
+            graph = generateGraph(config.generate);
+        } catch (const std::exception &e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        std::cout << "Generated " << graph.size() << " vertices and " << graph.edgeCount() << " edges from "
+                << config.generate << std::endl;
+    } else if (!config.graphPath.empty()) {
+        try {
+            graph = loadGraph(config.graphPath, config.numThreads);
+        } catch (const std::exception &e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        std::cout << "Loaded " << graph.size() << " vertices and " << graph.edgeCount() << " edges from "
+                << config.graphPath << std::endl;
+    }
+
+    if (config.m == 0) {
+        config.m = config.mode == SolveMode::Chromatic ? defaultColorLimit(graph) : 3;
+    }
+
+    if (!config.tracePath.empty()) {
+        if (INSTRUMENTED) {
+            enableTracing();
+            resetTraceOrigin();
+        } else {
+            std::cerr << "Built without NCOLOURING_INSTRUMENT, the trace will be empty" << std::endl;
+        }
+    }
 
     // Function call
-    nGraphColoringProblem(graph, m);
+    nGraphColoringProblem(graph, config);
     return 0;
-}
\ No newline at end of file
+}
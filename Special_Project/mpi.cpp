@@ -1,283 +1,273 @@
 #include <mpi.h>
+#include <algorithm>
 #include <iostream>
+#include <memory>
 #include <vector>
-#include <queue>
-#include <tuple>     // for std::tuple
-#include <algorithm> // for std::fill_n, etc.
+#include <random>
+#include <thread>
 
-using namespace std;
+#include "instrumentation.h"
+#include "local_search.h"
+#include "mpi_common.h"
+#include "ordering.h"
+#include "transport.h"
 
-#define V 4   // number of vertices (for your example)
-bool graphGlobal[V][V] = {
-    {0, 1, 1, 1},
-    {1, 0, 1, 0},
-    {1, 1, 0, 1},
-    {1, 0, 1, 0},
-};
+using namespace std;
 
-static const int TAG_WORK = 1;
-static const int TAG_RESULT = 2;
-static const int TAG_TERMINATE = 3;
+// Nodes a rank explores between two looks at its message queue
+static const long long POLL_INTERVAL = 256;
 
-// Helper function: check if it's safe to color `vertex` with color `c`
-bool isSafe(int vertex, const vector<int> &coloring, int c) {
-    for (int i = 0; i < V; ++i) {
-        if (graphGlobal[vertex][i] && coloring[i] == c) {
-            return false;
-        }
-    }
-    return true;
-}
+// A busy rank already asks for more once it has fewer spare branches than this,
+// so the next batch is on its way before it runs dry
+static const size_t PREFETCH_THRESHOLD = 2;
 
 /**
- * A struct to represent a "partial job" or state:
- *  - 'coloring': partial color assignment
- *  - 'nextVertex': the next vertex index to color
- *    (everything < nextVertex is assigned, everything >= nextVertex is not)
+ * Every rank runs the same code: it searches its own DFS stack and only talks to the others
+ * when it runs dry (steals from a random peer), when a peer asks it for work, to pass the
+ * termination token along, or to report a solution to rank 0. Rank 0 starts with the whole
+ * problem; the others get going by stealing from it and from each other.
+ * Count and Chromatic mode search the whole tree; Chromatic mode shares its bound through a
+ * SharedBound window and stops early only if some rank hits the lower bound.
+ * With --checkpoint, rank 0 calls for a checkpoint every so often (see checkpoint.h) and every rank
+ * writes its part in the background; a restarted job begins from its share of one instead of the root.
+ * One call searches one graph (a core of the input, see solveDecomposed()); the outcome is left in
+ * the totals for the caller to print.
  */
-struct WorkItem {
-    int coloring[V];
-    int nextVertex;
-};
-
-// Serialize WorkItem to a simple buffer so we can MPI_Send it
-// This is a quick & dirty approach: we just store nextVertex followed by the coloring array.
-void packWorkItem(const WorkItem &work, int *buffer) {
-    buffer[0] = work.nextVertex;
-    for (int i = 0; i < V; i++) {
-        buffer[i + 1] = work.coloring[i];
-    }
-}
-
-// Deserialize WorkItem from buffer
-WorkItem unpackWorkItem(const int *buffer) {
-    WorkItem w{};
-    w.nextVertex = buffer[0];
-    for (int i = 0; i < V; i++) {
-        w.coloring[i] = buffer[i + 1];
+RunTotals searchCode(int rank, int numProcs, const Graph &graph, int m, const Ordering &ordering, SolveMode mode,
+                     const JobSetup &setup) {
+    const MPI_Comm comm = setup.comm;
+    Checkpointer *checkpoint = setup.checkpoint;
+    SearchGoal goal(mode, m, setup.lowerBound, setup.nogoodBytes);
+    LocalSearch search(graph, m, ordering, goal);
+
+    // What the runs before the restart counted, so that the next checkpoint and the totals include it
+    SolutionCount carried;
+    long long carriedNodes = 0;
+    if (setup.resume) {
+        for (const WorkItem &w: setup.resume->items) {
+            search.push(w);
+        }
+        carried = setup.resume->count;
+        carriedNodes = setup.resume->nodes;
+        const vector<int> &incumbent = setup.resume->incumbent;
+        if (!incumbent.empty()) {
+            goal.adopt(incumbent, *max_element(incumbent.begin(), incumbent.end()));
+        }
+    } else if (rank == 0) {
+        search.push(WorkItem{vector<int>(graph.size(), 0), 0});
     }
-    return w;
-}
 
-// Print a solution
-void printSolution(const int coloring[V]) {
-    cout << "Solution found:\n";
-    for (int i = 0; i < V; i++) {
-        cout << "\tVertex " << i << " -> color " << coloring[i] << "\n";
+    unique_ptr<SharedBound> bound;
+    if (mode == SolveMode::Chromatic) {
+        bound = make_unique<SharedBound>(m + 1, comm);
     }
-    cout << endl;
-}
-
-// Worker process logic
-void workerCode(int rank, int numProcs, int m) {
-    bool done = false;
 
-    while (!done) {
-        // Probe for any incoming message
-        MPI_Status status;
-        MPI_Probe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
-
-        int tag = status.MPI_TAG;
-
-        if (tag == TAG_TERMINATE) {
-            // Master told us to stop
-            done = true;
-            // Drain the message
-            MPI_Recv(nullptr, 0, MPI_INT, status.MPI_SOURCE, tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    Termination term;
+    term.comm = comm;
+    term.haveToken = rank == 0; // Rank 0 launches the first round once it runs out of work
+    minstd_rand rng(7919u * rank + 1);
+
+    bool done = false; // Rank 0 decided (or told us) that the search is over
+    bool solved = false; // We found a coloring ourselves and stopped searching
+    bool stealPending = false; // A steal request is out and its reply receive is posted
+    WorkTransport transport(graph.size(), comm);
+    vector<WorkItem> batch;
+    RunTotals totals;
+
+    auto terminateAll = [&]() {
+        broadcastTerminate(numProcs, comm);
+        done = true;
+    };
+
+    // Our part of the checkpoint: a reply to a steal request still on its way goes into it as well
+    auto takeCheckpoint = [&]() {
+        FrontierShare share;
+        search.frontier(share.items);
+        share.nodes = carriedNodes + search.nodes();
+        share.count = carried;
+        share.count += search.counted();
+        if (mode == SolveMode::Chromatic) {
+            share.incumbent = goal.incumbent();
         }
-        else if (tag == TAG_WORK) {
-            // We got work to do
-            // 1) figure out how large the message is
-            int count;
-            MPI_Get_count(&status, MPI_INT, &count);
-            vector<int> buffer(count);
-            // 2) actually receive the work
-            MPI_Recv(buffer.data(), count, MPI_INT, status.MPI_SOURCE, tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-
-            // Unpack the partial state
-            WorkItem w = unpackWorkItem(buffer.data());
-
-            // If nextVertex == V, we have a complete solution
-            if (w.nextVertex == V) {
-                // Found a solution
-                // Send it back to master (or we could broadcast a terminate)
-                MPI_Send(buffer.data(), count, MPI_INT, 0, TAG_RESULT, MPI_COMM_WORLD);
-                // We can continue or just wait for a terminate signal from master
-                // We'll continue the loop, but eventually the master will send TAG_TERMINATE
+        traceInstant("checkpoint");
+        checkpoint->begin(std::move(share), stealPending);
+    };
+
+    auto handleMessage = [&](const MPI_Status &status) {
+        const int sender = status.MPI_SOURCE;
+
+        switch (status.MPI_TAG) {
+            case TAG_STEAL: {
+                MPI_Recv(nullptr, 0, MPI_INT, sender, TAG_STEAL, comm, MPI_STATUS_IGNORE);
+
+                // Hand over half of what we could spare, so the batch grows with our own backlog;
+                // always answer, an empty batch means "nothing here" (or "wait for the checkpoint")
+                batch.clear();
+                if (!solved && !(checkpoint && checkpoint->active())) {
+                    const size_t amount = min<size_t>(max<size_t>(search.spare() / 2, 1), WorkTransport::MAX_BATCH);
+                    WorkItem w;
+                    while (batch.size() < amount && search.split(w)) {
+                        batch.push_back(std::move(w));
+                    }
+                }
+                transport.send(batch, sender, TAG_WORK);
+                bump(Counter::ItemsGiven, batch.size());
+                if (!batch.empty()) {
+                    term.workSent();
+                }
+                break;
             }
-            else {
-                // Try all m color assignments for w.nextVertex
-                for (int c = 1; c <= m; ++c) {
-                    if (isSafe(w.nextVertex, vector<int>(begin(w.coloring), end(w.coloring)), c)) {
-                        WorkItem newWork = w;
-                        newWork.coloring[w.nextVertex] = c;
-                        newWork.nextVertex = w.nextVertex + 1;
-
-                        // Send partial solution back to master for distribution or direct recursion
-                        const int sz = V + 1;
-                        int sendBuf[sz];
-                        packWorkItem(newWork, sendBuf);
-                        // We'll just send it to rank 0 so it can manage the queue
-                        MPI_Send(sendBuf, sz, MPI_INT, 0, TAG_WORK, MPI_COMM_WORLD);
+            case TAG_TOKEN:
+                term.receiveToken(sender, rank);
+                break;
+            case TAG_CHECKPOINT:
+                MPI_Recv(nullptr, 0, MPI_INT, sender, TAG_CHECKPOINT, comm, MPI_STATUS_IGNORE);
+                takeCheckpoint();
+                break;
+            case TAG_RESULT:
+                // Only rank 0 receives these; the first one wins
+                // (in Chromatic mode the coloring is picked up again by gatherResults)
+                transport.receive(status, batch);
+                term.workReceived();
+                if (!done) {
+                    if (mode == SolveMode::First) {
+                        totals.coloring = batch.front().coloring;
                     }
+                    terminateAll();
                 }
+                break;
+            case TAG_TERMINATE:
+                MPI_Recv(nullptr, 0, MPI_INT, sender, TAG_TERMINATE, comm, MPI_STATUS_IGNORE);
+                done = true;
+                break;
+            default: {
+                // Unexpected, just drain it
+                int count;
+                MPI_Get_count(&status, MPI_BYTE, &count);
+                vector<char> sink(count);
+                MPI_Recv(sink.data(), count, MPI_BYTE, sender, status.MPI_TAG, comm, MPI_STATUS_IGNORE);
             }
         }
-        else {
-            // Unexpected, just drain it
-            MPI_Recv(nullptr, 0, MPI_INT, status.MPI_SOURCE, tag, MPI_COMM_WORLD, &status);
+    };
+
+    auto requestWork = [&]() {
+        const int victim = pickVictim(rng, rank, numProcs);
+        // Post the receive for the reply first, so the batch lands straight in a buffer
+        transport.postReceive(victim, TAG_WORK);
+        MPI_Send(nullptr, 0, MPI_INT, victim, TAG_STEAL, comm);
+        stealPending = true;
+        bump(Counter::StealAttempts);
+    };
+    // Not while a checkpoint is in progress: the victim may not have taken its snapshot yet, and what it
+    // handed over after our own would then be in neither part
+    auto mayRequestWork = [&]() {
+        return !stealPending && !(checkpoint && checkpoint->active());
+    };
+
+    // Service whatever arrived: the reply to our steal request, then everything else
+    auto poll = [&]() {
+        if (bound) {
+            goal.tighten(bound->exchange(goal.boundColors()));
         }
-    }
-}
 
-// Master process logic
-void masterCode(int rank, int numProcs, int m) {
-    // We'll keep a queue of partial solutions
-    queue<WorkItem> workQueue;
-
-    // Initialize partial solutions. Let's start with vertex=0
-    // Try each color for the first vertex
-    for (int c = 1; c <= m; ++c) {
-        WorkItem w{};
-        fill_n(w.coloring, V, 0);
-        w.coloring[0] = c;
-        w.nextVertex = 1;
-        workQueue.push(w);
-    }
-
-    // Use a simple round-robin to send initial jobs
-    // In a real app, you'd dynamically pop from the queue and send to whichever worker is idle
-    // but for brevity, we’ll do a simple approach.
-    // We keep track of how many workers are actually available (numProcs-1)
-    // because rank 0 is the master
-    int activeWorkers = numProcs - 1;
-
-    // If there are no workers (e.g. mpirun -np 1), trivial fallback
-    if (activeWorkers < 1) {
-        cout << "No workers available. Exiting." << endl;
-        return;
-    }
-
-    // We’ll store any partial solutions that come back from workers to the master
-    // so that the master can re-distribute them or check if they're complete solutions.
-    bool solutionFound = false;
-    WorkItem solutionWork{};
-
-    while (!solutionFound) {
-        // Distribute as many items in the queue as we can, one per worker
-        // (or all to a single worker, whichever pattern you prefer).
-        // For a more robust approach, we’d do non-blocking sends & track worker availability.
-        // This is a simplified approach:
-        for (int wRank = 1; wRank <= activeWorkers; ++wRank) {
-            if (!workQueue.empty()) {
-                WorkItem w = workQueue.front();
-                workQueue.pop();
-                // Send it
-                int buffer[V+1];
-                packWorkItem(w, buffer);
-                MPI_Send(buffer, V+1, MPI_INT, wRank, TAG_WORK, MPI_COMM_WORLD);
+        transport.progress();
+        if (stealPending && transport.test(batch)) {
+            stealPending = false;
+            if (checkpoint && checkpoint->awaitingReply()) {
+                checkpoint->addReply(batch);
             }
-            else {
-                // No more immediate partial solutions in queue
-                break;
+            bump(batch.empty() ? Counter::StealsEmpty : Counter::ItemsStolen, max<size_t>(batch.size(), 1));
+            if (!batch.empty()) {
+                term.workReceived();
+                for (auto &w: batch) {
+                    if (!solved) {
+                        search.push(std::move(w));
+                    }
+                }
             }
         }
 
-        // Now we wait for either:
-        //  1) a worker to return a full solution (TAG_RESULT), or
-        //  2) a worker to return partial solutions (TAG_WORK), or
-        //  3) we realize the queue is empty and no new solutions are coming => no solution
-        //
-        // For simplicity, let's do a single MPI_Probe to see what's up.
-
-        // If there's no immediate message and queue is empty, we might be done
-        // But let's do a small check to see if we can get a message with MPI_Iprobe
-        MPI_Status status;
         int flag = 0;
-        MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &flag, &status);
+        MPI_Status status;
+        MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, comm, &flag, &status);
+        while (flag && !done) {
+            handleMessage(status);
+            MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, comm, &flag, &status);
+        }
 
-        if (!flag) {
-            // No message right now. Are we done?
-            if (workQueue.empty()) {
-                // We have no partial solutions left to distribute
-                // So there's no new work to be discovered
-                // => either a solution is found soon or none is possible
-                // Let’s do an MPI_Probe that blocks or a small sleep
-                // But to keep it simpler, we could block waiting for a message:
-                MPI_Probe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
-            }
-            else {
-                // We still have partial solutions in queue, so just continue the outer loop
-                continue;
+        if (checkpoint && !done) {
+            if (checkpoint->due()) {
+                for (int r = 1; r < numProcs; ++r) {
+                    MPI_Send(nullptr, 0, MPI_INT, r, TAG_CHECKPOINT, comm);
+                }
+                takeCheckpoint();
             }
+            checkpoint->progress();
         }
+    };
 
-        // Now we definitely have a message, receive it
-        int tag = status.MPI_TAG;
-        int sender = status.MPI_SOURCE;
-
-        if (tag == TAG_RESULT) {
-            // A worker found a complete solution
-            int count;
-            MPI_Get_count(&status, MPI_INT, &count);
-            vector<int> buffer(count);
-            MPI_Recv(buffer.data(), count, MPI_INT, sender, tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    std::int64_t idleSince = -1; // When we last ran out of work, -1 while busy
+    while (!done) {
+        if (!solved && search.hasWork()) {
+            if (idleSince >= 0) {
+                recordIdle(idleSince);
+                idleSince = -1;
+            }
+            if (search.run(POLL_INTERVAL)) {
+                solved = true;
+                if (rank == 0) {
+                    if (mode == SolveMode::First) {
+                        totals.coloring = search.solution();
+                    }
+                    terminateAll();
+                    break;
+                }
+                transport.send({WorkItem{search.solution(), graph.size()}}, 0, TAG_RESULT);
+                term.workSent();
+            }
 
-            WorkItem w = unpackWorkItem(buffer.data());
-            solutionFound = true;
-            solutionWork = w;
+            if (numProcs > 1 && mayRequestWork() && search.spare() < PREFETCH_THRESHOLD) {
+                requestWork();
+            }
+            poll();
+            continue;
         }
-        else if (tag == TAG_WORK) {
-            // This means a worker is returning new partial solutions
-            int count;
-            MPI_Get_count(&status, MPI_INT, &count);
-            vector<int> buffer(count);
-            MPI_Recv(buffer.data(), count, MPI_INT, sender, tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-
-            // That’s 1 partial solution in this simplified approach
-            WorkItem w = unpackWorkItem(buffer.data());
 
-            // If nextVertex == V => complete solution
-            if (w.nextVertex == V) {
-                // We found a solution
-                solutionFound = true;
-                solutionWork = w;
-            } else {
-                // Just push it to our local queue
-                workQueue.push(w);
-            }
+        // Idle from here on
+        if (numProcs == 1) {
+            break;
         }
-        else {
-            // Possibly TAG_TERMINATE from some other reason, or unexpected
-            // Let's just drain it
-            MPI_Recv(nullptr, 0, MPI_INT, sender, tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        if (idleSince < 0) {
+            idleSince = traceNow();
         }
-
-        // Check if we found a solution
-        if (solutionFound) {
-            // Broadcast a terminate message to all workers
-            for (int wRank = 1; wRank < numProcs; ++wRank) {
-                MPI_Send(nullptr, 0, MPI_INT, wRank, TAG_TERMINATE, MPI_COMM_WORLD);
-            }
-            // Print the solution
-            printSolution(solutionWork.coloring);
-            return;
+        if (term.haveToken && term.passToken(rank, numProcs)) {
+            terminateAll();
+            break;
+        }
+        if (mayRequestWork() && !solved) {
+            requestWork();
         }
 
-        // If queue is empty and we never found a solution => no solution
-        // But let's not do that until we are sure no worker is in flight
-        // (In a real code, we'd track how many in-flight tasks exist.)
-        // For the tiny example, we can check again at the top of the loop.
-
-        // This loop then continues until we find a solution or exhaust all possibilities.
+        // Nothing to do until somebody answers; let other ranks sharing the core get on with it
+        poll();
+        this_thread::yield();
     }
 
-    // If we ever exit while(!solutionFound) loop without returning, that means no solution was found
-    // So we broadcast terminate
-    for (int wRank = 1; wRank < numProcs; ++wRank) {
-        MPI_Send(nullptr, 0, MPI_INT, wRank, TAG_TERMINATE, MPI_COMM_WORLD);
+    if (idleSince >= 0) {
+        recordIdle(idleSince);
+    }
+    bump(Counter::Nodes, search.nodes());
+    bump(Counter::Backtracks, search.backtracks());
+
+    drainUntilQuiet(transport, comm, checkpoint);
+    bound.reset();
+    if (mode != SolveMode::First) {
+        carried += search.counted();
+        gatherResults(goal, carried, m, graph.size(), comm, totals);
     }
-    cout << "No solution found.\n";
+    totals.nodes = search.nodes();
+    totals.firstSolution = goal.firstSolutionSeconds();
+    return totals;
 }
 
 int main(int argc, char** argv) {
@@ -287,16 +277,26 @@ int main(int argc, char** argv) {
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &numProcs);
 
-    // number of colors
-    int m = 3; // try 3 for your graph
-
-    if (rank == 0) {
-        // master
-        masterCode(rank, numProcs, m);
-    } else {
-        // worker
-        workerCode(rank, numProcs, m);
+    // number of colors, graph file and heuristics
+    MpiOptions options;
+    if (!parseMpiOptions(argc, argv, rank, options)) {
+        MPI_Finalize();
+        return 1;
     }
+    setupGraph(options, rank);
+
+    setupTracing(options, rank);
+
+    // No master any more: every rank searches and steals from its peers
+    MPI_Barrier(MPI_COMM_WORLD);
+    resetTraceOrigin();
+    const double start = MPI_Wtime();
+    const RunTotals totals = solveDecomposed(options, rank, 1, [&](const Graph &graph, const JobSetup &setup) {
+        // Every rank derives the same ordering from the same graph, so no need to ship it around
+        const Ordering ordering(graph, options.vertexOrder, options.valueOrder);
+        return searchCode(rank, numProcs, graph, options.m, ordering, options.mode, setup);
+    });
+    reportRun(options, "mpi", rank, numProcs, 1, MPI_Wtime() - start, totals);
 
     MPI_Finalize();
     return 0;
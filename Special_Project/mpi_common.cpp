@@ -0,0 +1,489 @@
+#include "mpi_common.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <stdexcept>
+
+#include "benchmark.h"
+#include "decomposition.h"
+#include "generators.h"
+#include "instrumentation.h"
+#include "loader.h"
+#include "search_state.h"
+
+using namespace std;
+
+Graph graphGlobal;
+
+bool parseMpiOptions(int argc, char **argv, int rank, MpiOptions &options) {
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!strcmp(argv[i], "--colors")) {
+            options.m = atoi(argv[i + 1]);
+            if (options.m < 1 || options.m > SearchState::MAX_COLORS) {
+                if (rank == 0) {
+                    cerr << "--colors must be between 1 and " << SearchState::MAX_COLORS << endl;
+                }
+                return false;
+            }
+        } else if (!strcmp(argv[i], "--graph")) {
+            options.graphPath = argv[i + 1];
+        } else if (!strcmp(argv[i], "--generate")) {
+            options.generate = argv[i + 1];
+        } else if (!strcmp(argv[i], "--csv")) {
+            options.csvPath = argv[i + 1];
+        } else if (!strcmp(argv[i], "--series")) {
+            options.series = argv[i + 1];
+        } else if (!strcmp(argv[i], "--trace")) {
+            options.tracePath = argv[i + 1];
+        } else if (!strcmp(argv[i], "--nogoods")) {
+            options.nogoodMegabytes = static_cast<size_t>(atoi(argv[i + 1]));
+        } else if (!strcmp(argv[i], "--decompose")) {
+            options.decompose = atoi(argv[i + 1]) != 0;
+        } else if (!strcmp(argv[i], "--checkpoint")) {
+            options.checkpointPath = argv[i + 1];
+        } else if (!strcmp(argv[i], "--checkpoint-every")) {
+            options.checkpointSeconds = atof(argv[i + 1]);
+        } else if (!strcmp(argv[i], "--threads")) {
+            options.threads = static_cast<unsigned>(atoi(argv[i + 1]));
+        } else if (!strcmp(argv[i], "--order")) {
+            if (!parseVertexOrder(argv[i + 1], options.vertexOrder) && rank == 0) {
+                cerr << "Unknown vertex order " << argv[i + 1] << endl;
+            }
+        } else if (!strcmp(argv[i], "--values")) {
+            if (!parseValueOrder(argv[i + 1], options.valueOrder) && rank == 0) {
+                cerr << "Unknown value order " << argv[i + 1] << endl;
+            }
+        } else if (!strcmp(argv[i], "--mode")) {
+            if (!parseSolveMode(argv[i + 1], options.mode) && rank == 0) {
+                cerr << "Unknown mode " << argv[i + 1] << endl;
+            }
+        } else if (rank == 0) {
+            cerr << "Unknown option " << argv[i] << endl;
+        }
+    }
+    return true;
+}
+
+void setupGraph(MpiOptions &options, int rank) {
+    if (!options.generate.empty()) {
+        // Seeded, so every rank generates the very same graph
+        try {
+            graphGlobal = generateGraph(options.generate);
+        } catch (const exception &e) { // A bad spec, or one too big to build (bad_alloc, length_error)
+            if (rank == 0) {
+                cerr << e.what() << endl;
+            }
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+    } else if (options.graphPath.empty()) {
+        /*
+          (3)---(2)
+           |   / |
+           |  /  |
+           | /   |
+          (0)---(1)
+        */
+        graphGlobal = Graph(4);
+        graphGlobal.addEdge(0, 1);
+        graphGlobal.addEdge(0, 2);
+        graphGlobal.addEdge(0, 3);
+        graphGlobal.addEdge(1, 2);
+        graphGlobal.addEdge(2, 3);
+    } else {
+        // Every rank maps the same file; the page cache makes the extra readers cheap
+        try {
+            graphGlobal = loadGraph(options.graphPath);
+        } catch (const exception &e) { // Malformed, or too big for this rank's memory
+            cerr << "Rank " << rank << ": " << e.what() << endl;
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+    }
+
+    if (options.m == 0) {
+        options.m = options.mode == SolveMode::Chromatic ? defaultColorLimit(graphGlobal) : 3;
+    }
+}
+
+void setupTracing(const MpiOptions &options, int rank) {
+    if (options.tracePath.empty()) {
+        return;
+    }
+    if (INSTRUMENTED) {
+        enableTracing();
+    } else if (rank == 0) {
+        cerr << "Built without NCOLOURING_INSTRUMENT, the trace will be empty" << endl;
+    }
+}
+
+// Print a solution
+void printSolution(const vector<int> &coloring) {
+    cout << "Solution found:\n";
+    for (int i = 0; i < static_cast<int>(coloring.size()); i++) {
+        cout << "\tVertex " << i << " -> color " << coloring[i] << "\n";
+    }
+    cout << endl;
+}
+
+int pickVictim(minstd_rand &rng, int rank, int numProcs) {
+    int victim = static_cast<int>(rng() % (numProcs - 1));
+    if (victim >= rank) {
+        ++victim; // Anybody but ourselves
+    }
+    return victim;
+}
+
+void broadcastTerminate(int numProcs, MPI_Comm comm) {
+    for (int r = 1; r < numProcs; ++r) {
+        MPI_Send(nullptr, 0, MPI_INT, r, TAG_TERMINATE, comm);
+    }
+}
+
+void Termination::receiveToken(int source, int rank) {
+    MPI_Recv(token, 2, MPI_LONG_LONG, source, TAG_TOKEN, comm, MPI_STATUS_IGNORE);
+    haveToken = true;
+    tokenReturned = rank == 0;
+}
+
+bool Termination::passToken(int rank, int numProcs) {
+    if (rank == 0) {
+        if (tokenReturned && !token[0] && !black && token[1] + counter == 0) {
+            haveToken = false;
+            return true;
+        }
+        // Start a fresh round
+        token[0] = 0;
+        token[1] = 0;
+    } else {
+        token[0] = token[0] || black;
+        token[1] += counter;
+    }
+
+    black = false;
+    haveToken = false;
+    tokenReturned = false;
+    MPI_Send(token, 2, MPI_LONG_LONG, (rank + 1) % numProcs, TAG_TOKEN, comm);
+    return false;
+}
+
+SharedBound::SharedBound(int initial, MPI_Comm comm) {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+
+    int *value = nullptr;
+    MPI_Win_allocate(rank == 0 ? sizeof(int) : 0, sizeof(int), MPI_INFO_NULL, comm, &value, &win);
+    if (rank == 0) {
+        *value = initial;
+    }
+    // Nobody touches the window before rank 0 has written the initial value
+    MPI_Barrier(comm);
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, win);
+}
+
+SharedBound::~SharedBound() {
+    MPI_Win_unlock_all(win);
+    MPI_Win_free(&win);
+}
+
+int SharedBound::exchange(int local) {
+    int global;
+    MPI_Fetch_and_op(&local, &global, MPI_INT, 0, 0, MPI_MIN, win);
+    MPI_Win_flush(0, win);
+    return min(global, local);
+}
+
+void gatherResults(const SearchGoal &goal, const SolutionCount &count, int m, int vertices, MPI_Comm comm,
+                   RunTotals &totals) {
+    if (goal.mode() == SolveMode::Count) {
+        unsigned long long local[2] = {count.colorings, count.classes};
+        unsigned long long total[2] = {0, 0};
+        MPI_Reduce(local, total, 2, MPI_UNSIGNED_LONG_LONG, MPI_SUM, 0, comm);
+        totals.count.colorings = total[0];
+        totals.count.classes = total[1];
+        return;
+    }
+
+    // The rank holding the smallest coloring broadcasts it (ties go to the lowest rank)
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    int mine[2] = {goal.incumbentColors(), rank};
+    int best[2];
+    MPI_Allreduce(mine, best, 1, MPI_2INT, MPI_MINLOC, comm);
+    if (best[0] > m) {
+        totals.coloring.clear();
+        return;
+    }
+
+    totals.coloring = goal.incumbent();
+    totals.coloring.resize(vertices);
+    MPI_Bcast(totals.coloring.data(), vertices, MPI_INT, best[1], comm);
+}
+
+RunTotals solveDecomposed(const MpiOptions &options, int rank, unsigned numThreads, const SearchJob &job) {
+    const double start = MPI_Wtime();
+    const int n = graphGlobal.size();
+    const int lowerBound = greedyCliqueSize(graphGlobal);
+
+    // Count mode needs every coloring of the peeled vertices too, so it always searches the whole graph
+    Decomposition parts;
+    if (n == 0 && options.mode != SolveMode::Count) {
+        // No cores at all: the empty coloring is complete and uses no colors
+    } else if (options.decompose && options.mode != SolveMode::Count) {
+        const int k = options.mode == SolveMode::Chromatic ? lowerBound : options.m;
+        parts = decompose(graphGlobal, k, numThreads);
+        if (rank == 0) {
+            cout << describeDecomposition(parts, k) << endl;
+        }
+    } else {
+        parts.cores.emplace_back(n);
+        iota(parts.cores.front().begin(), parts.cores.front().end(), 0);
+    }
+
+    // In Chromatic mode every core only has to reach the colors an earlier one needed
+    RunTotals totals;
+    vector<int> coloring(n, 0);
+    size_t solved = 0; // Cores colored so far
+    int lower = lowerBound;
+
+    // Pick up where the last checkpoint left off, and keep taking them
+    optional<Resume> resume;
+    unique_ptr<Checkpointer> checkpoint;
+    if (!options.checkpointPath.empty()) {
+        int numProcs;
+        MPI_Comm_size(MPI_COMM_WORLD, &numProcs);
+        try {
+            resume = loadCheckpoint(options.checkpointPath, graphGlobal, options.mode, options.m, rank, numProcs);
+            if (resume && (resume->position.core >= static_cast<int>(parts.cores.size()) ||
+                           static_cast<int>(parts.cores[resume->position.core].size()) != resume->coreVertices)) {
+                throw runtime_error("Checkpoint " + options.checkpointPath + " was taken with another --decompose");
+            }
+            checkpoint = make_unique<Checkpointer>(options.checkpointPath, graphGlobal, options.mode, options.m,
+                                                   options.checkpointSeconds);
+        } catch (const runtime_error &e) {
+            if (rank == 0) {
+                cerr << e.what() << endl;
+            }
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+    }
+    size_t resumed = parts.cores.size(); // Core the checkpoint was taken in
+    if (resume) {
+        resumed = resume->position.core;
+        solved = resumed;
+        lower = resume->position.lowerBound;
+        coloring = resume->position.coloring;
+        if (rank == 0) {
+            cout << "Resuming from checkpoint " << resume->epoch << " of " << options.checkpointPath << " in core "
+                    << solved + 1 << " of " << parts.cores.size() << " (" << resume->share.nodes
+                    << " nodes explored before)" << endl;
+        }
+    }
+
+    for (size_t index = solved; index < parts.cores.size(); ++index) {
+        const vector<int> &core = parts.cores[index];
+        Graph sub;
+        const Graph *jobGraph = &graphGlobal;
+        if (static_cast<int>(core.size()) < n) {
+            sub = inducedSubgraph(graphGlobal, core);
+            jobGraph = &sub;
+        }
+
+        const double jobStart = MPI_Wtime() - start;
+        JobSetup setup;
+        setup.lowerBound = lower;
+        setup.nogoodBytes = coreNogoodBytes(options.nogoodMegabytes << 20, core.size());
+        MPI_Comm_dup(MPI_COMM_WORLD, &setup.comm);
+        if (checkpoint) {
+            checkpoint->beginJob(RunPosition{static_cast<int>(index), lower, coloring}, static_cast<int>(core.size()),
+                                 setup.comm);
+            setup.checkpoint = checkpoint.get();
+        }
+        if (index == resumed) {
+            setup.resume = &resume->share;
+        }
+        RunTotals part;
+        {
+            ScopedSpan span("core");
+            part = job(*jobGraph, setup);
+        }
+        MPI_Comm_free(&setup.comm);
+        totals.nodes += part.nodes;
+        totals.count += part.count;
+        // The whole graph has a coloring once the last core got its first one
+        totals.firstSolution = part.firstSolution < 0 ? -1 : jobStart + part.firstSolution;
+        if (options.mode == SolveMode::Count) {
+            break;
+        }
+
+        // First mode: only rank 0 holds the coloring, so it tells the others whether there is one
+        int found = !part.coloring.empty();
+        if (options.mode == SolveMode::First) {
+            MPI_Bcast(&found, 1, MPI_INT, 0, MPI_COMM_WORLD);
+        }
+        if (!found) {
+            break;
+        }
+        if (!part.coloring.empty()) {
+            placeCore(core, part.coloring, coloring);
+            lower = max(lower, *max_element(part.coloring.begin(), part.coloring.end()));
+        }
+        ++solved;
+    }
+
+    // The run is over, nothing left to restart
+    if (checkpoint) {
+        checkpoint->removeOnClose();
+        checkpoint.reset();
+    }
+
+    const bool colored = options.mode != SolveMode::Count && solved == parts.cores.size();
+    if (colored && totals.firstSolution < 0) {
+        totals.firstSolution = MPI_Wtime() - start; // Nothing was left to search
+    }
+    if (rank != 0) {
+        return totals;
+    }
+
+    if (options.mode == SolveMode::Count) {
+        totals.result = "colorings=" + to_string(totals.count.colorings);
+        cout << "Found " << totals.count.colorings << " colorings with at most " << options.m << " colors ("
+                << totals.count.classes << " up to renaming the colors)" << endl;
+    } else if (!colored) {
+        if (options.mode == SolveMode::First) {
+            cout << "No solution found.\n";
+        } else {
+            cout << "No coloring with at most " << options.m << " colors exists" << endl;
+        }
+    } else {
+        colorPeeled(graphGlobal, parts.peeled, coloring);
+        if (options.mode == SolveMode::First) {
+            totals.result = "colorable";
+        } else {
+            // Every core either ran out (nothing smaller exists) or matched the clique or an earlier core
+            const int used = coloring.empty() ? 0 : *max_element(coloring.begin(), coloring.end());
+            totals.result = "chromatic=" + to_string(used);
+            cout << "Chromatic number is " << used << endl;
+        }
+        printSolution(coloring);
+    }
+    return totals;
+}
+
+// The counters summed over the ranks, with the least and most any rank had; every rank's trace in one file
+static void reportInstrumentation(const MpiOptions &options, const char *engine, int rank, int numProcs) {
+    if constexpr (INSTRUMENTED) {
+        const CounterValues mine = processCounters();
+        CounterValues total{}, least{}, most{};
+        MPI_Reduce(mine.data(), total.data(), NUM_COUNTERS, MPI_UNSIGNED_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+        MPI_Reduce(mine.data(), least.data(), NUM_COUNTERS, MPI_UNSIGNED_LONG_LONG, MPI_MIN, 0, MPI_COMM_WORLD);
+        MPI_Reduce(mine.data(), most.data(), NUM_COUNTERS, MPI_UNSIGNED_LONG_LONG, MPI_MAX, 0, MPI_COMM_WORLD);
+        if (rank == 0) {
+            cout << describeCounters(total, least, most, "rank") << endl;
+        }
+    }
+    if (options.tracePath.empty()) {
+        return;
+    }
+
+    const string events = traceEventsJson(rank, string(engine) + " rank " + to_string(rank));
+    const int length = static_cast<int>(events.size());
+    vector<int> lengths(rank == 0 ? numProcs : 0);
+    MPI_Gather(&length, 1, MPI_INT, lengths.data(), 1, MPI_INT, 0, MPI_COMM_WORLD);
+    vector<int> offsets(lengths.size(), 0);
+    for (size_t r = 1; r < lengths.size(); ++r) {
+        offsets[r] = offsets[r - 1] + lengths[r - 1];
+    }
+    string all(rank == 0 ? offsets.back() + lengths.back() : 0, '\0');
+    MPI_Gatherv(events.data(), length, MPI_CHAR, all.data(), lengths.data(), offsets.data(), MPI_CHAR, 0,
+                MPI_COMM_WORLD);
+    if (rank != 0) {
+        return;
+    }
+
+    vector<string> processes;
+    for (int r = 0; r < numProcs; ++r) {
+        processes.push_back(all.substr(offsets[r], lengths[r]));
+    }
+    try {
+        writeTraceFile(options.tracePath, processes);
+    } catch (const runtime_error &e) {
+        cerr << e.what() << endl;
+    }
+}
+
+void reportRun(const MpiOptions &options, const char *engine, int rank, int numProcs, unsigned threads,
+               double seconds, const RunTotals &totals) {
+    reportInstrumentation(options, engine, rank, numProcs);
+
+    long long nodes = 0;
+    MPI_Reduce(&totals.nodes, &nodes, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    // The ranks that never found one stay out of the minimum
+    const double mine = totals.firstSolution < 0 ? 1e300 : totals.firstSolution;
+    double first = 0;
+    MPI_Reduce(&mine, &first, 1, MPI_DOUBLE, MPI_MIN, 0, MPI_COMM_WORLD);
+    if (rank != 0) {
+        return;
+    }
+
+    cout << "Explored " << nodes << " nodes in " << seconds << "s on " << numProcs << " ranks x " << threads
+            << " threads (" << (seconds > 0 ? nodes / seconds : 0) << " nodes/s)" << endl;
+    if (options.csvPath.empty()) {
+        return;
+    }
+
+    BenchmarkRow row;
+    row.engine = engine;
+    row.graph = !options.generate.empty() ? options.generate : !options.graphPath.empty() ? options.graphPath : "example";
+    row.series = options.series;
+    row.vertices = graphGlobal.size();
+    row.edges = graphGlobal.edgeCount();
+    row.ranks = numProcs;
+    row.threads = static_cast<int>(threads);
+    row.mode = solveModeName(options.mode);
+    row.colors = options.m;
+    row.seconds = seconds;
+    row.nodes = nodes;
+    row.firstSolution = first < 1e300 ? first : -1;
+    row.result = totals.result;
+    try {
+        appendBenchmarkRow(options.csvPath, row);
+    } catch (const runtime_error &e) {
+        cerr << e.what() << endl;
+    }
+}
+
+void drainUntilQuiet(WorkTransport &transport, MPI_Comm comm, Checkpointer *checkpoint) {
+    transport.cancelReceive();
+    if (checkpoint) {
+        checkpoint->finish();
+    }
+
+    MPI_Request barrier = MPI_REQUEST_NULL;
+    int finished = 0;
+    while (!finished) {
+        int flag = 0;
+        MPI_Status status;
+        MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, comm, &flag, &status);
+        if (flag) {
+            int count;
+            MPI_Get_count(&status, MPI_BYTE, &count);
+            vector<char> sink(count);
+            MPI_Recv(sink.data(), count, MPI_BYTE, status.MPI_SOURCE, status.MPI_TAG, comm,
+                     MPI_STATUS_IGNORE);
+        }
+
+        transport.progress();
+        if (checkpoint) {
+            checkpoint->progress();
+        }
+        if (barrier == MPI_REQUEST_NULL) {
+            if (transport.sendsIdle() && !(checkpoint && checkpoint->active())) {
+                MPI_Ibarrier(comm, &barrier);
+            }
+        } else {
+            MPI_Test(&barrier, &finished, MPI_STATUS_IGNORE);
+        }
+    }
+}
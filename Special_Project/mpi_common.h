@@ -0,0 +1,156 @@
+#pragma once
+#include <mpi.h>
+#include <cstddef>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "checkpoint.h"
+#include "graph.h"
+#include "ordering.h"
+#include "search_goal.h"
+#include "transport.h"
+
+// Every rank builds the same graph at startup; its size is only known at runtime. The engines search
+// the cores of it they are handed (see solveDecomposed()), this is the whole input.
+extern Graph graphGlobal;
+
+static const int TAG_WORK = 1; // A batch of subproblems answering a steal request (empty = none to spare)
+static const int TAG_RESULT = 2; // A full coloring, sent to rank 0
+static const int TAG_TERMINATE = 3; // Rank 0 says stop: solved, or no solution anywhere
+static const int TAG_STEAL = 4; // An idle rank asks for work
+static const int TAG_TOKEN = 6; // Dijkstra-Safra termination token
+// TAG_CHECKPOINT = 7 lives in checkpoint.h
+
+// Command line shared by the MPI and hybrid solvers
+struct MpiOptions {
+    int m = 0; // Number of colors; 0 = 3, or in Chromatic mode max degree + 1 (always enough)
+    std::string graphPath; // Empty means the built-in example
+    std::string generate; // Generator spec (see generators.h), used instead of a file
+    VertexOrder vertexOrder = VertexOrder::Dsatur;
+    ValueOrder valueOrder = ValueOrder::Index;
+    SolveMode mode = SolveMode::First;
+    std::size_t nogoodMegabytes = 32; // Nogood cache per rank (shared by its threads), 0 = none
+    bool decompose = true; // Peel and split the graph into cores first (see decomposition.h); never in Count mode
+    unsigned threads = 0; // Hybrid only: search threads per rank, 0 = one per core minus the communication thread
+    std::string checkpointPath; // MPI only: checkpoint into (and resume from) this path's .0 and .1, empty = never
+    double checkpointSeconds = 300; // Between two checkpoints
+    std::string csvPath; // Rank 0 appends the run's numbers to this benchmark CSV (see benchmark.h)
+    std::string series; // Weak-scaling series the run belongs to
+    std::string tracePath; // Rank 0 writes every rank's Chrome trace (see instrumentation.h) here, empty = none
+};
+
+// Usage: [--graph file | --generate spec] [--colors m] [--order index|degree|smallest-last|dsatur]
+//        [--values index|lcv] [--mode first|count|chromatic] [--nogoods megabytes] [--decompose 0|1]
+//        [--threads n] [--checkpoint path] [--checkpoint-every seconds] [--csv file] [--series name]
+//        [--trace file]
+// Returns false (after rank 0 complained) if the options make no sense
+bool parseMpiOptions(int argc, char **argv, int rank, MpiOptions &options);
+
+// Generates options.generate or loads options.graphPath (or the 4-vertex example) into graphGlobal and
+// settles the default number of colors, which depends on the graph; aborts the job if either is bad
+void setupGraph(MpiOptions &options, int rank);
+
+// With --trace, every thread records its trace from now on (see instrumentation.h). Before the search threads start.
+void setupTracing(const MpiOptions &options, int rank);
+
+void printSolution(const std::vector<int> &coloring);
+
+// Random peer other than `rank`
+int pickVictim(std::minstd_rand &rng, int rank, int numProcs);
+
+// Rank 0 only: tell every other rank to stop
+void broadcastTerminate(int numProcs, MPI_Comm comm);
+
+/**
+ * Dijkstra-Safra termination detection.
+ *
+ * Only non-empty TAG_WORK batches can wake an idle rank up, and a TAG_RESULT still on its way to rank 0 must
+ * not be dropped by the final drain, so those are the ones we count: +1 per send, -1 per receive, and
+ * receiving one blackens the rank. A token travels 0 -> 1 -> ... -> P-1 -> 0
+ * and is only passed on by idle ranks, summing the counters and picking up any black on the way.
+ * When it returns white to a white, idle rank 0 with a total of zero, no work is left anywhere
+ * and none is in flight.
+ */
+struct Termination {
+    MPI_Comm comm = MPI_COMM_WORLD; // Of the job whose end it detects
+    long long counter = 0; // Non-empty TAG_WORK batches and TAG_RESULTs sent minus received
+    bool black = false;
+    bool haveToken = false;
+    bool tokenReturned = false; // Rank 0 only: the token in hand finished a round
+    long long token[2] = {0, 0}; // {black, count}
+
+    void workSent() { ++counter; }
+    void workReceived() {
+        --counter;
+        black = true;
+    }
+    void receiveToken(int source, int rank);
+
+    // Call while idle and holding the token. True on rank 0 once termination is detected.
+    bool passToken(int rank, int numProcs);
+};
+
+/**
+ * Chromatic mode: the fewest colors any rank has managed so far, in a one-sided window on rank 0.
+ * exchange() folds our own best in with MPI_MIN and reads the global one back in the same
+ * MPI_Fetch_and_op, so no rank ever has to stop and answer for it. Passive target, so rank 0's
+ * search carries on undisturbed. Construction and destruction are collective over comm.
+ */
+class SharedBound {
+public:
+    SharedBound(int initial, MPI_Comm comm);
+    ~SharedBound();
+    SharedBound(const SharedBound &) = delete;
+    SharedBound &operator=(const SharedBound &) = delete;
+
+    int exchange(int local); // Publish `local` and return the global minimum
+
+private:
+    MPI_Win win = MPI_WIN_NULL;
+};
+
+// What an engine hands back for one job: this rank's own numbers, and the outcome of the whole search
+struct RunTotals {
+    long long nodes = 0;
+    double firstSolution = -1; // This rank's goal, -1 if it never completed a coloring
+    std::vector<int> coloring; // First mode: the coloring, on rank 0 only. Chromatic mode: the best, on every rank.
+    SolutionCount count; // Count mode: the totals, on rank 0
+    std::string result = "none"; // Filled in by solveDecomposed() for the benchmark CSV
+};
+
+// Count and Chromatic mode, after drainUntilQuiet: add the counts up on rank 0, or hand every rank the
+// best coloring any rank found (left empty if none has at most m colors). Collective over comm.
+void gatherResults(const SearchGoal &goal, const SolutionCount &count, int m, int vertices, MPI_Comm comm,
+                   RunTotals &totals);
+
+// What an engine gets for one job besides its graph
+struct JobSetup {
+    int lowerBound = 1; // Of the goal
+    std::size_t nogoodBytes = 0;
+    MPI_Comm comm = MPI_COMM_NULL; // Of its own, so nothing still in flight from one job can be taken for part of the next
+    Checkpointer *checkpoint = nullptr; // With --checkpoint, ready for this job
+    const FrontierShare *resume = nullptr; // Restarting into this job: search this instead of the root
+};
+
+// One search on every rank at once. Collective.
+using SearchJob = std::function<RunTotals(const Graph &graph, const JobSetup &setup)>;
+
+// Runs the job on the whole of graphGlobal in Count mode (or without --decompose), otherwise on each core
+// of its decomposition in turn, largest first, on all ranks together. Puts the colorings back together,
+// colors the peeled vertices and prints the outcome on rank 0. numThreads is what decompose() may use.
+// With --checkpoint it first picks up the checkpoint left there, if any, from the core it was taken in.
+// Collective; every rank splits the graph alike, so the cores need not be shipped around.
+RunTotals solveDecomposed(const MpiOptions &options, int rank, unsigned numThreads, const SearchJob &job);
+
+// Adds the nodes up, takes the earliest first solution and prints the throughput on rank 0, which also
+// appends the benchmark CSV row if asked to. In an instrumented build it also adds up every rank's counters
+// and prints their spread over the ranks, and with --trace gathers the ranks' traces into one file. Collective.
+void reportRun(const MpiOptions &options, const char *engine, int rank, int numProcs, unsigned threads,
+               double seconds, const RunTotals &totals);
+
+// Everybody stops together: keep receiving (and dropping) whatever is still in flight until
+// all ranks reached this point with their own sends completed (and the checkpoint in progress, if any,
+// written), so nothing is left hanging at MPI_Finalize
+void drainUntilQuiet(WorkTransport &transport, MPI_Comm comm, Checkpointer *checkpoint = nullptr);
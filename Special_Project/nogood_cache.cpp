@@ -0,0 +1,86 @@
+#include "nogood_cache.h"
+#include <algorithm>
+#include <bit>
+
+namespace {
+    constexpr std::uint64_t REFERENCED = 1;
+
+    // data = check bits 8..63 | bound << 1 | referenced
+    std::uint64_t pack(std::uint64_t check, int bound) {
+        return (check & ~std::uint64_t{0xff}) | static_cast<std::uint64_t>(std::clamp(bound, 1, 127)) << 1;
+    }
+
+    int boundOf(std::uint64_t data) {
+        return static_cast<int>((data >> 1) & 127);
+    }
+
+    bool matches(std::uint64_t tag, std::uint64_t data, std::uint64_t hash, std::uint64_t check) {
+        return data != 0 && (tag ^ data) == hash && (data >> 8) == (check >> 8);
+    }
+}
+
+NogoodCache::NogoodCache(std::size_t bytes) {
+    const std::size_t count = std::bit_floor(std::max<std::size_t>(bytes / sizeof(Bucket), 1));
+    buckets = std::make_unique<Bucket[]>(count);
+    mask = count - 1;
+}
+
+bool NogoodCache::contains(std::uint64_t hash, std::uint64_t check, int bound) {
+    Bucket &bucket = buckets[hash & mask];
+    for (Slot &slot: bucket.slots) {
+        const std::uint64_t data = slot.data.load(std::memory_order_relaxed);
+        const std::uint64_t tag = slot.tag.load(std::memory_order_relaxed);
+        if (!matches(tag, data, hash, check)) {
+            continue;
+        }
+        if (boundOf(data) < bound) {
+            return false; // Only refuted for more colors than we are allowed now
+        }
+        // Give it a second chance against the clock hand; written only on the first hit after a pass
+        if (!(data & REFERENCED)) {
+            slot.data.store(data | REFERENCED, std::memory_order_relaxed);
+            slot.tag.store(hash ^ (data | REFERENCED), std::memory_order_relaxed);
+        }
+        return true;
+    }
+    return false;
+}
+
+void NogoodCache::insert(std::uint64_t hash, std::uint64_t check, int bound) {
+    Bucket &bucket = buckets[hash & mask];
+    const std::uint64_t fresh = pack(check, bound);
+
+    // Already known: keep whichever bound says more
+    for (Slot &slot: bucket.slots) {
+        const std::uint64_t data = slot.data.load(std::memory_order_relaxed);
+        const std::uint64_t tag = slot.tag.load(std::memory_order_relaxed);
+        if (matches(tag, data, hash, check)) {
+            if (boundOf(data) < bound) {
+                const std::uint64_t raised = fresh | (data & REFERENCED);
+                slot.data.store(raised, std::memory_order_relaxed);
+                slot.tag.store(hash ^ raised, std::memory_order_relaxed);
+            }
+            return;
+        }
+    }
+
+    // Clock: an empty slot, or the first one nobody used since the hand last passed it
+    Slot *victim = nullptr;
+    for (Slot &slot: bucket.slots) {
+        const std::uint64_t data = slot.data.load(std::memory_order_relaxed);
+        if (data == 0 || !(data & REFERENCED)) {
+            victim = &slot;
+            break;
+        }
+        const std::uint64_t tag = slot.tag.load(std::memory_order_relaxed);
+        slot.data.store(data & ~REFERENCED, std::memory_order_relaxed);
+        slot.tag.store(tag ^ REFERENCED, std::memory_order_relaxed);
+    }
+    if (!victim) {
+        victim = &bucket.slots[hash >> 62]; // All of them were in use: any one will do
+    }
+
+    // A racing writer can leave a mix of both entries behind; it fails matches() and just reads as a miss
+    victim->data.store(fresh, std::memory_order_relaxed);
+    victim->tag.store(hash ^ fresh, std::memory_order_relaxed);
+}
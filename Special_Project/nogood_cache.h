@@ -0,0 +1,51 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+/**
+ * Bounded table of search states known to lead nowhere ("nogoods"), shared by every thread of a
+ * process without a lock.
+ *
+ * A state is looked up by SearchState::nogoodHash(), which only covers the uncolored vertices, the
+ * number of colors in use and the coloring of the frontier, up to renaming the colors: one refuted
+ * state also rules out every state that differs only in which vertices lie behind the frontier or in
+ * the names of the colors. Each entry remembers the bound
+ * it was refuted under: nothing below the state colors the graph with fewer than `bound` colors.
+ *
+ * Buckets of four 16-byte slots fill one cache line. A slot stores (tag ^ data, data), so a reader
+ * racing a writer sees a tag that does not match and simply misses; torn entries never verify
+ * (lockless hashing as in chess transposition tables). data packs 56 bits of the check hash, the
+ * bound and a clock "referenced" bit. Insertion takes the first slot of the bucket that was not
+ * referenced since the hand last went by, clearing the bits it passes, so old entries age out and
+ * the memory stays at what the constructor got.
+ */
+class NogoodCache {
+public:
+    explicit NogoodCache(std::size_t bytes); // Rounded down to a power of two of buckets, at least one
+
+    NogoodCache(const NogoodCache &) = delete;
+    NogoodCache &operator=(const NogoodCache &) = delete;
+
+    // True if the state was refuted under a bound of at least `bound`
+    bool contains(std::uint64_t hash, std::uint64_t check, int bound);
+    void insert(std::uint64_t hash, std::uint64_t check, int bound);
+
+    std::size_t capacity() const { return (mask + 1) * SLOTS; }
+
+private:
+    static constexpr int SLOTS = 4;
+
+    struct Slot {
+        std::atomic<std::uint64_t> tag{0};
+        std::atomic<std::uint64_t> data{0}; // 0 = never used
+    };
+
+    struct alignas(64) Bucket {
+        Slot slots[SLOTS];
+    };
+
+    std::unique_ptr<Bucket[]> buckets;
+    std::size_t mask;
+};
@@ -0,0 +1,161 @@
+#include "ordering.h"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <numeric>
+
+namespace {
+    // Matula & Beck: peel a minimum-degree vertex off the remaining graph until none are left,
+    // then color in the reverse order. Bucket queue by current degree keeps it O(n + E).
+    std::vector<int> smallestLastOrder(const Graph &graph) {
+        const int n = graph.size();
+        int maxDegree = 0;
+        std::vector<int> degree(n);
+        for (int v = 0; v < n; ++v) {
+            degree[v] = graph.degree(v);
+            maxDegree = std::max(maxDegree, degree[v]);
+        }
+
+        std::vector<std::vector<int> > buckets(maxDegree + 1);
+        for (int v = 0; v < n; ++v) {
+            buckets[degree[v]].push_back(v);
+        }
+
+        std::vector<char> removed(n, 0);
+        std::vector<int> order(n);
+        int low = 0;
+        for (int position = n - 1; position >= 0; --position) {
+            int v = -1;
+            while (v < 0) {
+                while (buckets[low].empty()) {
+                    ++low;
+                }
+                const int candidate = buckets[low].back();
+                buckets[low].pop_back();
+                // Vertices get re-bucketed when their degree drops; skip the stale copies
+                if (!removed[candidate] && degree[candidate] == low) {
+                    v = candidate;
+                }
+            }
+
+            removed[v] = 1;
+            order[position] = v;
+            for (int u: graph.neighbours(v)) {
+                if (!removed[u]) {
+                    buckets[--degree[u]].push_back(u);
+                    low = std::min(low, degree[u]);
+                }
+            }
+        }
+        return order;
+    }
+}
+
+bool parseVertexOrder(const char *name, VertexOrder &order) {
+    if (!strcmp(name, "index")) {
+        order = VertexOrder::Index;
+    } else if (!strcmp(name, "degree")) {
+        order = VertexOrder::LargestFirst;
+    } else if (!strcmp(name, "smallest-last")) {
+        order = VertexOrder::SmallestLast;
+    } else if (!strcmp(name, "dsatur")) {
+        order = VertexOrder::Dsatur;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool parseValueOrder(const char *name, ValueOrder &order) {
+    if (!strcmp(name, "index")) {
+        order = ValueOrder::Index;
+    } else if (!strcmp(name, "lcv")) {
+        order = ValueOrder::LeastConstraining;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+Ordering::Ordering(const Graph &graph, VertexOrder vertices, ValueOrder values) : g(&graph), vertices(vertices),
+    values(values) {
+    if (vertices == VertexOrder::Dsatur) {
+        return;
+    }
+
+    sequence.resize(graph.size());
+    std::iota(sequence.begin(), sequence.end(), 0);
+    if (vertices == VertexOrder::LargestFirst) {
+        std::stable_sort(sequence.begin(), sequence.end(), [&graph](int a, int b) {
+            return graph.degree(a) > graph.degree(b);
+        });
+    } else if (vertices == VertexOrder::SmallestLast) {
+        sequence = smallestLastOrder(graph);
+    }
+}
+
+int Ordering::nextVertex(const SearchState &state) const {
+    const int n = g->size();
+    if (state.coloredCount() == n) {
+        return -1;
+    }
+
+    if (vertices != VertexOrder::Dsatur) {
+        // The search colors the sequence front to back, so everything before this point is normally done;
+        // scanning on from there also copes with prefixes colored some other way
+        for (int i = state.coloredCount(); i < n; ++i) {
+            if (state.color(sequence[i]) == 0) {
+                return sequence[i];
+            }
+        }
+        for (int i = 0; i < n; ++i) {
+            if (state.color(sequence[i]) == 0) {
+                return sequence[i];
+            }
+        }
+        return -1;
+    }
+
+    // DSATUR: smallest remaining domain, then highest degree. Forced vertices (one color left) come first.
+    int best = -1;
+    for (int v = 0; v < n; ++v) {
+        if (state.color(v) != 0) {
+            continue;
+        }
+        if (best < 0 || state.domainSize(v) < state.domainSize(best) ||
+            (state.domainSize(v) == state.domainSize(best) && g->degree(v) > g->degree(best))) {
+            best = v;
+            if (state.domainSize(v) <= 1) {
+                break; // Cannot get any more saturated than this
+            }
+        }
+    }
+    return best;
+}
+
+int Ordering::orderColors(const SearchState &state, int v, int out[], int maxColor) const {
+    std::uint64_t mask = state.candidates(v);
+    if (maxColor < SearchState::MAX_COLORS) {
+        mask &= (1ULL << std::max(maxColor, 0)) - 1;
+    }
+
+    int count = 0;
+    for (; mask; mask &= mask - 1) {
+        out[count++] = std::countr_zero(mask) + 1;
+    }
+
+    if (values == ValueOrder::LeastConstraining && count > 1) {
+        // How many uncolored neighbours would lose each color
+        int cost[SearchState::MAX_COLORS + 1] = {0};
+        for (int u: g->neighbours(v)) {
+            if (state.color(u) != 0) {
+                continue;
+            }
+            for (int i = 0; i < count; ++i) {
+                cost[out[i]] += state.allowed(u, out[i]);
+            }
+        }
+        std::stable_sort(out, out + count, [&cost](int a, int b) { return cost[a] < cost[b]; });
+    }
+    return count;
+}
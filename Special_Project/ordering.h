@@ -0,0 +1,44 @@
+#pragma once
+#include <vector>
+
+#include "graph.h"
+#include "search_state.h"
+
+// Which uncolored vertex the search branches on next
+enum class VertexOrder {
+    Index, // 0, 1, 2, ... (the original behaviour)
+    LargestFirst, // Static: highest degree first
+    SmallestLast, // Static: reverse of repeatedly peeling the minimum-degree vertex
+    Dsatur // Dynamic: fewest colors left (most saturated), ties broken by degree
+};
+
+// In which order the colors of the chosen vertex are tried
+enum class ValueOrder {
+    Index, // 1, 2, ..., m
+    LeastConstraining // The color that removes the fewest options from uncolored neighbours first
+};
+
+// Both return false for an unknown name: "index", "degree", "smallest-last", "dsatur" / "index", "lcv"
+bool parseVertexOrder(const char *name, VertexOrder &order);
+bool parseValueOrder(const char *name, ValueOrder &order);
+
+/**
+ * Variable and value ordering for the coloring search. Static orders are computed once up front;
+ * DSATUR reads the domain sizes SearchState already maintains, so it needs no extra bookkeeping.
+ */
+class Ordering {
+public:
+    Ordering(const Graph &graph, VertexOrder vertices, ValueOrder values);
+
+    int nextVertex(const SearchState &state) const; // -1 once every vertex is colored
+
+    // Writes the still-allowed colors of v that are <= maxColor into out, in the order they should be
+    // tried; returns how many
+    int orderColors(const SearchState &state, int v, int out[], int maxColor = SearchState::MAX_COLORS) const;
+
+private:
+    const Graph *g;
+    VertexOrder vertices;
+    ValueOrder values;
+    std::vector<int> sequence; // Static orders only
+};
@@ -0,0 +1,153 @@
+#include "search_goal.h"
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+
+bool parseSolveMode(const char *name, SolveMode &mode) {
+    if (!strcmp(name, "first")) {
+        mode = SolveMode::First;
+    } else if (!strcmp(name, "count")) {
+        mode = SolveMode::Count;
+    } else if (!strcmp(name, "chromatic")) {
+        mode = SolveMode::Chromatic;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char *solveModeName(SolveMode mode) {
+    switch (mode) {
+        case SolveMode::First:
+            return "first";
+        case SolveMode::Count:
+            return "count";
+        case SolveMode::Chromatic:
+            break;
+    }
+    return "chromatic";
+}
+
+void SolutionCount::add(int m, int used) {
+    unsigned long long ways = 1;
+    for (int i = 0; i < used; ++i) {
+        ways *= static_cast<unsigned long long>(m - i);
+    }
+    ++classes;
+    colorings += ways;
+}
+
+SearchGoal::SearchGoal(SolveMode mode, int m, int lowerBound, std::size_t nogoodBytes) : solveMode(mode), m(m),
+    lower(lowerBound), bound(m + 1), bestColors(m + 1) {
+    if (nogoodBytes > 0) {
+        nogoods = std::make_unique<NogoodCache>(nogoodBytes);
+    }
+}
+
+bool SearchGoal::complete(const SearchState &state, SolutionCount &count) {
+    const int used = state.maxColorUsed();
+    if (firstFound.load(std::memory_order_relaxed) < 0) {
+        long long none = -1;
+        const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - created).count();
+        firstFound.compare_exchange_strong(none, elapsed, std::memory_order_relaxed);
+    }
+
+    switch (solveMode) {
+        case SolveMode::First: {
+            std::lock_guard lock(mtx);
+            if (best.empty()) {
+                best = state.coloring();
+                bestColors = used;
+            }
+            return true;
+        }
+        case SolveMode::Count:
+            count.add(m, used);
+            return false;
+        case SolveMode::Chromatic:
+            break;
+    }
+
+    {
+        std::lock_guard lock(mtx);
+        if (used < bestColors) {
+            best = state.coloring();
+            bestColors = used;
+        }
+    }
+    tighten(used);
+    return used <= lower;
+}
+
+void SearchGoal::tighten(int colors) {
+    int current = bound.load(std::memory_order_relaxed);
+    while (colors < current && !bound.compare_exchange_weak(current, colors, std::memory_order_relaxed)) {
+    }
+}
+
+void SearchGoal::adopt(const std::vector<int> &coloring, int colors) {
+    {
+        std::lock_guard lock(mtx);
+        if (colors < bestColors) {
+            best = coloring;
+            bestColors = colors;
+        }
+    }
+    tighten(colors);
+}
+
+double SearchGoal::firstSolutionSeconds() const {
+    const long long nanos = firstFound.load(std::memory_order_relaxed);
+    return nanos < 0 ? -1.0 : static_cast<double>(nanos) / 1e9;
+}
+
+int SearchGoal::incumbentColors() const {
+    std::lock_guard lock(mtx);
+    return bestColors;
+}
+
+std::vector<int> SearchGoal::incumbent() const {
+    std::lock_guard lock(mtx);
+    return best;
+}
+
+int defaultColorLimit(const Graph &graph) {
+    int maxDegree = 0;
+    for (int v = 0; v < graph.size(); ++v) {
+        maxDegree = std::max(maxDegree, graph.degree(v));
+    }
+    return std::min(maxDegree + 1, SearchState::MAX_COLORS);
+}
+
+int greedyCliqueSize(const Graph &graph) {
+    // A handful of starting points is plenty for a bound that only serves as an early exit
+    static const int STARTS = 32;
+
+    const int n = graph.size();
+    std::vector<int> byDegree(n);
+    std::iota(byDegree.begin(), byDegree.end(), 0);
+    std::stable_sort(byDegree.begin(), byDegree.end(), [&graph](int a, int b) {
+        return graph.degree(a) > graph.degree(b);
+    });
+
+    int largest = n > 0 ? 1 : 0;
+    std::vector<int> clique;
+    for (int s = 0; s < std::min(n, STARTS); ++s) {
+        const int start = byDegree[s];
+        clique.assign(1, start);
+
+        // Walk the neighbours by degree and keep every one adjacent to the whole clique so far
+        std::vector<int> candidates = graph.neighbours(start);
+        std::stable_sort(candidates.begin(), candidates.end(), [&graph](int a, int b) {
+            return graph.degree(a) > graph.degree(b);
+        });
+        for (int u: candidates) {
+            if (std::all_of(clique.begin(), clique.end(), [&graph, u](int w) { return graph.hasEdge(u, w); })) {
+                clique.push_back(u);
+            }
+        }
+        largest = std::max(largest, static_cast<int>(clique.size()));
+    }
+    return largest;
+}
@@ -0,0 +1,125 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "graph.h"
+#include "instrumentation.h"
+#include "nogood_cache.h"
+#include "search_state.h"
+
+// What the search is after
+enum class SolveMode {
+    First, // Stop at the first coloring with at most m colors (the original behaviour)
+    Count, // Visit and count every coloring with at most m colors
+    Chromatic // Fewest colors that work: branch and bound below the best coloring found so far
+};
+
+// False for an unknown name: "first", "count", "chromatic"
+bool parseSolveMode(const char *name, SolveMode &mode);
+const char *solveModeName(SolveMode mode);
+
+/**
+ * Count mode tallies, one per thread (or rank) and added up at the end.
+ *
+ * The search only lets a vertex open a new color if it is the next unused one (see colorLimit()),
+ * so every way of splitting the vertices into color classes is reached exactly once. Each such
+ * leaf using k colors stands for m * (m-1) * ... * (m-k+1) colorings once the names are put back.
+ */
+struct SolutionCount {
+    unsigned long long classes = 0; // Colorings up to renaming the colors
+    unsigned long long colorings = 0; // All colorings with colors 1..m (modulo 2^64 on huge counts)
+
+    void add(int m, int used);
+    SolutionCount &operator+=(const SolutionCount &other) {
+        classes += other.classes;
+        colorings += other.colorings;
+        return *this;
+    }
+};
+
+/**
+ * Goal of one search, shared by all threads of a process.
+ *
+ * In Chromatic mode the best coloring found so far is the incumbent: every branch is cut to
+ * colors below it, so each new coloring found is strictly smaller. The bound is a plain atomic
+ * the threads read on every node; only replacing the incumbent itself takes the lock.
+ * The search is over early once it reaches the lower bound (a clique needs that many colors).
+ *
+ * Given room for a NogoodCache, it also remembers the states whose whole subtree came back empty
+ * under the current bound, so the search can skip every state with the same uncolored vertices, the
+ * same number of colors in use and the same frontier coloring up to renaming (see SearchState::nogoodHash()) when it comes up again
+ * through another path, another thread, or a stolen work item.
+ */
+class SearchGoal {
+public:
+    static constexpr long long MIN_NOGOOD_NODES = 16; // Smaller subtrees are cheaper to search again than to remember
+
+    SearchGoal(SolveMode mode, int m, int lowerBound = 1, std::size_t nogoodBytes = 0); // 0 = no cache
+
+    SolveMode mode() const { return solveMode; }
+
+    // Highest color a vertex may get in the given state: one past the highest in use (anything
+    // higher is just a renaming of a branch we already try), and below the incumbent
+    int colorLimit(const SearchState &state) const {
+        return std::min(state.maxColorUsed() + 1, bound.load(std::memory_order_relaxed) - 1);
+    }
+
+    // The state colors every vertex. Records it (counts it, or keeps it as the incumbent);
+    // true when the whole search can stop.
+    bool complete(const SearchState &state, SolutionCount &count);
+
+    // Chromatic: another process found a coloring with this many colors; prune against it from now on
+    void tighten(int colors);
+
+    // Chromatic: a coloring found before a restart (see checkpoint.h) becomes the incumbent, unless a
+    // better one is kept already. Not counted as found in this run.
+    void adopt(const std::vector<int> &coloring, int colors);
+
+    // The state, or one equal to it up to what lies behind the frontier and the color names, was refuted
+    // before under a bound at least as loose
+    bool knownDead(const SearchState &state) const {
+        if (!nogoods || !nogoods->contains(state.nogoodHash(), state.nogoodCheck(), boundColors())) {
+            return false;
+        }
+        bump(Counter::NogoodHits);
+        return true;
+    }
+    // Everything below the state was searched with the current bound and nothing was found (in Count mode:
+    // nothing was counted). Never call it for a subtree the search gave away or was stopped in.
+    void recordDead(const SearchState &state) const {
+        if (nogoods) {
+            nogoods->insert(state.nogoodHash(), state.nogoodCheck(), boundColors());
+        }
+    }
+
+    int boundColors() const { return bound.load(std::memory_order_relaxed); } // m + 1 until anybody found one
+    double firstSolutionSeconds() const; // From construction to the first full coloring, -1 if none yet
+    int incumbentColors() const; // Of the coloring kept here, m + 1 if none
+    std::vector<int> incumbent() const; // Empty if none
+
+private:
+    SolveMode solveMode;
+    int m;
+    int lower;
+    std::atomic<int> bound;
+
+    std::chrono::steady_clock::time_point created = std::chrono::steady_clock::now();
+    std::atomic<long long> firstFound{-1}; // Nanoseconds after `created`, set once by whoever gets there first
+
+    std::unique_ptr<NogoodCache> nogoods; // Concurrent by itself; null when disabled
+
+    mutable std::mutex mtx;
+    std::vector<int> best;
+    int bestColors;
+};
+
+// Max degree + 1, capped at SearchState::MAX_COLORS: enough colors for any graph, the start of a Chromatic search
+int defaultColorLimit(const Graph &graph);
+
+// Size of a clique found greedily from the highest-degree vertices; no coloring can use fewer colors
+int greedyCliqueSize(const Graph &graph);
@@ -0,0 +1,168 @@
+#include "search_state.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+    // Two unrelated 64-bit finalizers (MurmurHash3's and SplitMix64's); both keep 0 at 0, so a class
+    // with nothing on the frontier adds nothing to either sum
+    std::uint64_t mixHash(std::uint64_t x) {
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33;
+        x *= 0xc4ceb9fe1a85ec53ULL;
+        return x ^ (x >> 33);
+    }
+
+    std::uint64_t mixCheck(std::uint64_t x) {
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ULL;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+
+    // Random-looking keys per vertex, one set for the classes and one for the uncolored set
+    std::uint64_t classKey(int v) {
+        return mixCheck((static_cast<std::uint64_t>(v) + 1) * 0x9e3779b97f4a7c15ULL);
+    }
+
+    std::uint64_t openKey(int v) {
+        return mixHash((static_cast<std::uint64_t>(v) + 1) * 0xd6e8feb86659fd93ULL);
+    }
+
+    std::uint64_t usedKey(int maxUsed) {
+        return (static_cast<std::uint64_t>(maxUsed) + 1) * 0xa0761d6478bd642fULL;
+    }
+}
+
+SearchState::SearchState(const Graph &graph, int m) : g(&graph), m(m),
+                                                       fullMask(m >= MAX_COLORS ? ~0ULL : (1ULL << m) - 1),
+                                                       colorOf(graph.size(), 0),
+                                                       forbidCount(static_cast<std::size_t>(graph.size()) * m, 0),
+                                                       forbiddenMask(graph.size(), 0), domain(graph.size(), m),
+                                                       usedCount(m + 1, 0), openNeighbours(graph.size(), 0),
+                                                       frontierKey(m + 1, 0) {
+    if (m < 1 || m > MAX_COLORS) {
+        throw std::invalid_argument("Number of colors must be between 1 and 64");
+    }
+    for (int v = 0; v < graph.size(); ++v) {
+        openNeighbours[v] = graph.degree(v);
+        uncoloredKey ^= openKey(v);
+    }
+}
+
+bool SearchState::reset(const int color[]) {
+    std::fill(colorOf.begin(), colorOf.end(), 0);
+    std::fill(forbidCount.begin(), forbidCount.end(), 0);
+    std::fill(forbiddenMask.begin(), forbiddenMask.end(), 0);
+    std::fill(domain.begin(), domain.end(), m);
+    std::fill(usedCount.begin(), usedCount.end(), 0);
+    std::fill(frontierKey.begin(), frontierKey.end(), 0);
+    colored = 0;
+    maxUsed = 0;
+    uncoloredKey = 0;
+    for (int v = 0; v < g->size(); ++v) {
+        openNeighbours[v] = g->degree(v);
+        uncoloredKey ^= openKey(v);
+    }
+
+    for (int v = 0; v < g->size(); ++v) {
+        if (color[v] > 0) {
+            assign(v, color[v]);
+        }
+    }
+
+    // The given assignment becomes the floor: nothing below it can be undone
+    trail.clear();
+    marks.clear();
+
+    for (int v = 0; v < g->size(); ++v) {
+        if (colorOf[v] == 0 && domain[v] == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SearchState::assign(int v, int c) {
+    const std::uint64_t bit = 1ULL << (c - 1);
+    bool wipeout = false;
+
+    marks.push_back(trail.size());
+    trail.push_back(v);
+    colorOf[v] = c;
+    ++colored;
+    ++usedCount[c];
+    maxUsed = std::max(maxUsed, c);
+    uncoloredKey ^= openKey(v);
+
+    // Touch every neighbour even after a wipe-out, so undo() has a single uniform path
+    for (int u: g->neighbours(v)) {
+        if (++forbidCount[static_cast<std::size_t>(u) * m + c - 1] == 1) {
+            forbiddenMask[u] |= bit;
+            if (--domain[u] == 0 && colorOf[u] == 0) {
+                wipeout = true;
+            }
+        }
+        // v was the last uncolored neighbour of a colored u: u is behind the frontier now
+        if (--openNeighbours[u] == 0 && colorOf[u] != 0) {
+            frontierKey[colorOf[u]] ^= classKey(u);
+        }
+        trail.push_back(u);
+    }
+    if (openNeighbours[v] > 0) {
+        frontierKey[c] ^= classKey(v);
+    }
+    return !wipeout;
+}
+
+void SearchState::undo() {
+    const std::size_t mark = marks.back();
+    marks.pop_back();
+
+    const int v = trail[mark];
+    const int c = colorOf[v];
+    const std::uint64_t bit = 1ULL << (c - 1);
+
+    if (openNeighbours[v] > 0) {
+        frontierKey[c] ^= classKey(v);
+    }
+    for (std::size_t i = trail.size(); i > mark + 1; --i) {
+        const int u = trail[i - 1];
+        if (--forbidCount[static_cast<std::size_t>(u) * m + c - 1] == 0) {
+            forbiddenMask[u] &= ~bit;
+            ++domain[u];
+        }
+        if (openNeighbours[u]++ == 0 && colorOf[u] != 0) {
+            frontierKey[colorOf[u]] ^= classKey(u);
+        }
+    }
+    trail.resize(mark);
+
+    uncoloredKey ^= openKey(v);
+    colorOf[v] = 0;
+    --colored;
+    if (--usedCount[c] == 0) {
+        while (maxUsed > 0 && usedCount[maxUsed] == 0) {
+            --maxUsed;
+        }
+    }
+}
+
+// The classes behind the frontier hash to nothing (mixHash(0) == 0), so maxUsed goes in on its own: under a
+// bound, a state with one more of them has fewer completions left (see SearchGoal::colorLimit())
+std::uint64_t SearchState::nogoodHash() const {
+    std::uint64_t sum = mixHash(uncoloredKey) + mixHash(usedKey(maxUsed));
+    for (int c = 1; c <= maxUsed; ++c) {
+        sum += mixHash(frontierKey[c]);
+    }
+    return sum;
+}
+
+std::uint64_t SearchState::nogoodCheck() const {
+    std::uint64_t sum = mixCheck(uncoloredKey) + mixCheck(usedKey(maxUsed));
+    for (int c = 1; c <= maxUsed; ++c) {
+        sum += mixCheck(frontierKey[c]);
+    }
+    return sum;
+}
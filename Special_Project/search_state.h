@@ -0,0 +1,69 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "graph.h"
+
+/**
+ * Partial coloring with forward checking.
+ *
+ * For every vertex we keep how many colored neighbours use each color, the resulting mask of
+ * forbidden colors and the size of what is left of its domain. assign() updates only the
+ * neighbours of the colored vertex and records them on an undo trail; undo() walks the trail
+ * back, so backtracking never copies or rescans the full assignment. The mask is the safety check:
+ * one word answers it for every color at once (allowed(), candidates()), with no scan of the graph.
+ *
+ * It also hashes what the rest of the search depends on, for the nogood cache: the set of uncolored
+ * vertices, the number of colors in use, and how the frontier (colored vertices that still have an
+ * uncolored neighbour) splits into color classes. A colored vertex whose neighbours are all colored constrains nothing any more,
+ * so two states that only differ behind the frontier have the same completions. assign() and undo()
+ * only keep an XOR of vertex keys per class up to date; the hash sums a mix of every class when it is
+ * asked for, which does not care which class has which color: every renaming hashes alike.
+ *
+ * Colors are 1-based (0 = uncolored) and at most 64 of them fit in a mask.
+ */
+class SearchState {
+public:
+    static constexpr int MAX_COLORS = 64;
+
+    SearchState(const Graph &graph, int m);
+
+    // Start over from a full color array (0 = uncolored). False if some uncolored vertex is already stuck.
+    bool reset(const int color[]);
+
+    // Color v with c. False if that left an uncolored neighbour without any color; undo() it either way.
+    bool assign(int v, int c);
+    void undo(); // Revert the most recent assign()
+
+    bool allowed(int v, int c) const { return !((forbiddenMask[v] >> (c - 1)) & 1); }
+    std::uint64_t candidates(int v) const { return ~forbiddenMask[v] & fullMask; } // Bit c-1 set = c allowed
+    int domainSize(int v) const { return domain[v]; }
+    int color(int v) const { return colorOf[v]; }
+    int coloredCount() const { return colored; }
+    int maxColorUsed() const { return maxUsed; } // Highest color some vertex has, 0 if none
+    int colors() const { return m; }
+    const std::vector<int> &coloring() const { return colorOf; }
+    std::uint64_t nogoodHash() const;
+    std::uint64_t nogoodCheck() const; // Independent second hash, to verify a match
+    const Graph &graph() const { return *g; }
+
+private:
+    const Graph *g;
+    int m;
+    std::uint64_t fullMask;
+    int colored = 0;
+
+    std::vector<int> colorOf;
+    std::vector<int> forbidCount; // n * m: colored neighbours of v that use color c
+    std::vector<std::uint64_t> forbiddenMask; // Bit c-1 set while forbidCount[v][c] > 0
+    std::vector<int> domain; // m - popcount(forbiddenMask[v])
+    std::vector<int> usedCount; // Vertices per color, index 1..m
+    int maxUsed = 0;
+
+    std::vector<int> openNeighbours; // Uncolored neighbours per vertex
+    std::vector<std::uint64_t> frontierKey; // Per color 1..m: XOR of the keys of its frontier vertices
+    std::uint64_t uncoloredKey = 0; // XOR of the keys of the uncolored vertices
+
+    std::vector<int> trail; // Per assign(): the colored vertex, then each neighbour it touched
+    std::vector<std::size_t> marks; // Trail length before each assign()
+};
@@ -0,0 +1,21 @@
+# ctest script: the chromatic number SOLVER finds for SPEC must not change when the nogood cache is turned off.
+# cmake -DSOLVER=<command, ;-separated> -DSPEC=<generator spec> -P nogood_chromatic.cmake
+
+set(results)
+foreach (megabytes 32 0)
+    execute_process(COMMAND ${SOLVER} --generate ${SPEC} --mode chromatic --decompose 0 --nogoods ${megabytes}
+            OUTPUT_VARIABLE output RESULT_VARIABLE status)
+    if (NOT status EQUAL 0)
+        message(FATAL_ERROR "${SPEC} with --nogoods ${megabytes} exited with ${status}:\n${output}")
+    endif ()
+    if (NOT output MATCHES "Chromatic number is ([0-9]+)")
+        message(FATAL_ERROR "${SPEC} with --nogoods ${megabytes} printed no chromatic number:\n${output}")
+    endif ()
+    list(APPEND results ${CMAKE_MATCH_1})
+endforeach ()
+
+list(GET results 0 cached)
+list(GET results 1 uncached)
+if (NOT cached EQUAL uncached)
+    message(FATAL_ERROR "${SPEC}: chromatic number ${cached} with the nogood cache, ${uncached} without")
+endif ()
@@ -0,0 +1,143 @@
+#include "thread_pool.h"
+#include <random>
+
+#include "instrumentation.h"
+
+namespace {
+    // Each pool worker remembers its own index, so submit() knows which deque is "local"
+    thread_local const ThreadPool *tlsPool = nullptr;
+    thread_local int tlsWorker = -1;
+}
+
+ThreadPool::ThreadPool(unsigned numThreads, std::stop_token cancel) : cancelToken(std::move(cancel)) {
+    if (numThreads == 0) {
+        numThreads = 1; // hardware_concurrency() is allowed to return 0
+    }
+
+    for (unsigned i = 0; i < numThreads; ++i) {
+        queues.push_back(std::make_unique<WorkerQueue>());
+    }
+    for (unsigned i = 0; i < numThreads; ++i) {
+        workers.emplace_back([this, i](std::stop_token shutdown) { workerLoop(i, shutdown); });
+    }
+    onCancel.emplace(cancelToken, [this] { discardQueued(); });
+}
+
+ThreadPool::~ThreadPool() {
+    wait();
+    onCancel.reset();
+    workers.clear(); // Each jthread asks its worker to stop, which wakes it from sleepCv, then joins
+}
+
+int ThreadPool::currentWorker() {
+    return tlsWorker;
+}
+
+void ThreadPool::submit(Task task) {
+    if (cancelToken.stop_requested()) {
+        return;
+    }
+    pending.fetch_add(1);
+
+    // Workers of this pool keep their children local; everybody else spreads the roots around
+    unsigned target = tlsPool == this
+                          ? static_cast<unsigned>(tlsWorker)
+                          : nextQueue.fetch_add(1) % size();
+    {
+        std::lock_guard lock(queues[target]->mtx);
+        queues[target]->tasks.push_back(std::move(task));
+    }
+    {
+        // Bump the counter under the sleep lock so a worker cannot miss the wake-up
+        std::lock_guard lock(sleepMtx);
+        queued.fetch_add(1);
+    }
+    sleepCv.notify_one();
+}
+
+void ThreadPool::wait() {
+    std::unique_lock lock(doneMtx);
+    doneCv.wait(lock, [this] { return pending.load() == 0; });
+}
+
+void ThreadPool::discardQueued() {
+    long long dropped = 0;
+    for (auto &queue: queues) {
+        std::lock_guard lock(queue->mtx);
+        dropped += static_cast<long long>(queue->tasks.size());
+        queue->tasks.clear();
+    }
+
+    queued.fetch_sub(dropped);
+    if (dropped > 0 && pending.fetch_sub(dropped) == dropped) {
+        std::lock_guard lock(doneMtx);
+        doneCv.notify_all();
+    }
+}
+
+bool ThreadPool::popLocal(unsigned id, Task &task) {
+    std::lock_guard lock(queues[id]->mtx);
+    if (queues[id]->tasks.empty()) {
+        return false;
+    }
+    task = std::move(queues[id]->tasks.back());
+    queues[id]->tasks.pop_back();
+    return true;
+}
+
+bool ThreadPool::steal(unsigned thief, Task &task) {
+    thread_local std::minstd_rand rng(std::random_device{}());
+    const unsigned n = size();
+    const unsigned start = rng() % n;
+
+    // Start at a random victim so thieves do not all gang up on worker 0
+    if (n > 1) {
+        bump(Counter::StealAttempts);
+    }
+    for (unsigned k = 0; k < n; ++k) {
+        unsigned victim = (start + k) % n;
+        if (victim == thief) {
+            continue;
+        }
+
+        std::lock_guard lock(queues[victim]->mtx);
+        if (!queues[victim]->tasks.empty()) {
+            task = std::move(queues[victim]->tasks.front());
+            queues[victim]->tasks.pop_front();
+            bump(Counter::ItemsStolen);
+            return true;
+        }
+    }
+    if (n > 1) {
+        bump(Counter::StealsEmpty);
+    }
+    return false;
+}
+
+void ThreadPool::workerLoop(unsigned id, std::stop_token shutdown) {
+    tlsPool = this;
+    tlsWorker = static_cast<int>(id);
+
+    while (true) {
+        Task task;
+        if (popLocal(id, task) || steal(id, task)) {
+            queued.fetch_sub(1);
+            task();
+
+            if (pending.fetch_sub(1) == 1) {
+                std::lock_guard lock(doneMtx);
+                doneCv.notify_all();
+            }
+            continue;
+        }
+
+        // Nothing to run anywhere: park until somebody submits or the pool shuts down
+        const std::int64_t idleSince = traceNow();
+        std::unique_lock lock(sleepMtx);
+        const bool woken = sleepCv.wait(lock, shutdown, [this] { return queued.load() > 0; });
+        recordIdle(idleSince);
+        if (!woken) {
+            return;
+        }
+    }
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+/**
+ * Fixed pool of worker threads (one per core by default) with per-worker deques and work stealing.
+ *
+ *  - A worker pushes and pops its own tasks at the back of its deque (LIFO), so the search stays
+ *    depth-first and the data it touches stays hot in cache.
+ *  - An idle worker steals from the front of a random victim's deque (FIFO), which hands it the
+ *    oldest task, i.e. the one closest to the root and usually the biggest subtree.
+ *
+ * Tasks may submit more tasks; wait() returns once every task, including the children, has run.
+ * Once the optional cancel token is stopped, queued tasks are dropped and new ones are ignored;
+ * tasks already running are expected to notice the same token themselves and return early.
+ */
+class ThreadPool {
+public:
+    using Task = std::function<void()>;
+
+    explicit ThreadPool(unsigned numThreads = std::thread::hardware_concurrency(), std::stop_token cancel = {});
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    void submit(Task task); // From a worker: onto its own deque. From outside: round-robin.
+    void wait(); // Block until there are no pending tasks left
+    unsigned size() const { return static_cast<unsigned>(queues.size()); }
+
+    static int currentWorker(); // Index of the calling worker, or -1 outside of any pool
+
+private:
+    struct WorkerQueue {
+        std::mutex mtx;
+        std::deque<Task> tasks;
+    };
+
+    void workerLoop(unsigned id, std::stop_token shutdown);
+    void discardQueued(); // The cancel token fired
+    bool popLocal(unsigned id, Task &task);
+    bool steal(unsigned thief, Task &task);
+
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    std::vector<std::jthread> workers; // Their own stop tokens shut the pool down
+    std::stop_token cancelToken;
+    std::optional<std::stop_callback<std::function<void()>>> onCancel;
+
+    std::atomic<long long> queued{0}; // Tasks sitting in some deque
+    std::atomic<long long> pending{0}; // Tasks submitted but not finished yet
+    std::atomic<unsigned> nextQueue{0};
+
+    std::mutex sleepMtx;
+    std::condition_variable_any sleepCv; // Idle workers park here, woken by work or by shutdown
+    std::mutex doneMtx;
+    std::condition_variable doneCv; // wait() parks here
+};
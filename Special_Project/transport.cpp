@@ -0,0 +1,122 @@
+#include "transport.h"
+#include <cstring>
+
+#include "instrumentation.h"
+
+WorkTransport::WorkTransport(int numVertices, MPI_Comm comm) : comm(comm), n(numVertices),
+                                                               stride((4 + numVertices + 3) / 4 * 4) {
+    // {int32 depth; uint8 colors[n]} padded to the stride, so consecutive items line up
+    int blockLengths[2] = {1, n};
+    MPI_Aint displacements[2] = {0, 4};
+    MPI_Datatype types[2] = {MPI_INT32_T, MPI_UINT8_T};
+    MPI_Datatype packed;
+    MPI_Type_create_struct(2, blockLengths, displacements, types, &packed);
+    MPI_Type_create_resized(packed, 0, stride, &itemType);
+    MPI_Type_commit(&itemType);
+    MPI_Type_free(&packed);
+
+    for (auto &slot: sendSlots) {
+        slot.bytes.resize(static_cast<std::size_t>(stride) * MAX_BATCH);
+    }
+    recvSlot.bytes.resize(static_cast<std::size_t>(stride) * MAX_BATCH);
+}
+
+WorkTransport::~WorkTransport() {
+    cancelReceive();
+    for (auto &slot: sendSlots) {
+        MPI_Wait(&slot.request, MPI_STATUS_IGNORE);
+    }
+    MPI_Type_free(&itemType);
+}
+
+void WorkTransport::pack(const std::vector<WorkItem> &batch, Slot &slot) const {
+    unsigned char *p = slot.bytes.data();
+    for (const WorkItem &w: batch) {
+        const std::int32_t depth = w.depth;
+        std::memcpy(p, &depth, 4);
+        for (int v = 0; v < n; ++v) {
+            p[4 + v] = static_cast<std::uint8_t>(w.coloring[v]); // Colors are at most 64, one byte is plenty
+        }
+        p += stride;
+    }
+}
+
+void WorkTransport::unpack(const unsigned char *bytes, int count, std::vector<WorkItem> &out) const {
+    out.clear();
+    for (int k = 0; k < count; ++k, bytes += stride) {
+        std::int32_t depth;
+        std::memcpy(&depth, bytes, 4);
+        out.push_back(WorkItem{std::vector<int>(bytes + 4, bytes + 4 + n), depth});
+    }
+}
+
+void WorkTransport::send(const std::vector<WorkItem> &batch, int dest, int tag) {
+    Slot &slot = sendSlots[nextSend];
+    nextSend ^= 1;
+
+    // Both buffers busy: this one went out first, so it is the one most likely done
+    MPI_Wait(&slot.request, MPI_STATUS_IGNORE);
+    pack(batch, slot);
+    MPI_Isend(slot.bytes.data(), static_cast<int>(batch.size()), itemType, dest, tag, comm, &slot.request);
+    bump(Counter::MessagesSent);
+    bump(Counter::BytesSent, static_cast<unsigned long long>(stride) * batch.size());
+}
+
+void WorkTransport::postReceive(int source, int tag) {
+    MPI_Irecv(recvSlot.bytes.data(), MAX_BATCH, itemType, source, tag, comm, &recvSlot.request);
+    recvPosted = true;
+}
+
+bool WorkTransport::test(std::vector<WorkItem> &out) {
+    if (!recvPosted) {
+        return false;
+    }
+
+    int flag = 0;
+    MPI_Status status;
+    MPI_Test(&recvSlot.request, &flag, &status);
+    if (!flag) {
+        return false;
+    }
+
+    int count = 0;
+    MPI_Get_count(&status, itemType, &count);
+    recvPosted = false;
+    unpack(recvSlot.bytes.data(), count, out);
+    bump(Counter::MessagesReceived);
+    bump(Counter::BytesReceived, static_cast<unsigned long long>(stride) * count);
+    return true;
+}
+
+void WorkTransport::cancelReceive() {
+    if (!recvPosted) {
+        return;
+    }
+
+    MPI_Cancel(&recvSlot.request);
+    MPI_Wait(&recvSlot.request, MPI_STATUS_IGNORE);
+    recvPosted = false;
+}
+
+void WorkTransport::receive(const MPI_Status &status, std::vector<WorkItem> &out) {
+    int count = 0;
+    MPI_Get_count(&status, itemType, &count);
+    std::vector<unsigned char> bytes(static_cast<std::size_t>(stride) * count);
+    MPI_Recv(bytes.data(), count, itemType, status.MPI_SOURCE, status.MPI_TAG, comm, MPI_STATUS_IGNORE);
+    unpack(bytes.data(), count, out);
+    bump(Counter::MessagesReceived);
+    bump(Counter::BytesReceived, static_cast<unsigned long long>(bytes.size()));
+}
+
+void WorkTransport::progress() {
+    for (auto &slot: sendSlots) {
+        if (slot.request != MPI_REQUEST_NULL) {
+            int flag = 0;
+            MPI_Test(&slot.request, &flag, MPI_STATUS_IGNORE);
+        }
+    }
+}
+
+bool WorkTransport::sendsIdle() const {
+    return sendSlots[0].request == MPI_REQUEST_NULL && sendSlots[1].request == MPI_REQUEST_NULL;
+}
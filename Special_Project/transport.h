@@ -0,0 +1,61 @@
+#pragma once
+#include <mpi.h>
+#include <cstdint>
+#include <vector>
+
+#include "local_search.h"
+
+/**
+ * Ships batches of WorkItems between ranks.
+ *
+ * One item on the wire is {int32 depth; uint8 colors[n]}, described by a committed MPI struct
+ * datatype resized to a 4-byte aligned stride, so a batch of k items is simply `k` elements of
+ * that type in one message. Sends go out with MPI_Isend from two alternating buffers: the caller
+ * fills the next batch while the previous one is still on its way. The reply to a steal request is
+ * received with an MPI_Irecv posted ahead of time; a rank has at most one steal out, so one receive
+ * buffer is enough.
+ */
+class WorkTransport {
+public:
+    static constexpr int MAX_BATCH = 64; // Items per message
+
+    WorkTransport(int numVertices, MPI_Comm comm);
+    ~WorkTransport();
+
+    WorkTransport(const WorkTransport &) = delete;
+    WorkTransport &operator=(const WorkTransport &) = delete;
+
+    // Pack and MPI_Isend; only blocks if both send buffers are still in flight
+    void send(const std::vector<WorkItem> &batch, int dest, int tag);
+
+    // Pre-post a receive for one batch from `source`; poll it with test()
+    void postReceive(int source, int tag);
+    bool receivePosted() const { return recvPosted; }
+    bool test(std::vector<WorkItem> &out); // True once the posted batch arrived (possibly empty)
+    void cancelReceive();
+
+    // Blocking receive of a message that MPI_Probe already matched
+    void receive(const MPI_Status &status, std::vector<WorkItem> &out);
+
+    void progress(); // Retire completed sends
+    bool sendsIdle() const; // Nothing in flight
+
+private:
+    struct Slot {
+        std::vector<unsigned char> bytes;
+        MPI_Request request = MPI_REQUEST_NULL;
+    };
+
+    void pack(const std::vector<WorkItem> &batch, Slot &slot) const;
+    void unpack(const unsigned char *bytes, int count, std::vector<WorkItem> &out) const;
+
+    MPI_Comm comm;
+    int n;
+    int stride; // Bytes per item
+    MPI_Datatype itemType = MPI_DATATYPE_NULL;
+
+    Slot sendSlots[2];
+    int nextSend = 0;
+    Slot recvSlot;
+    bool recvPosted = false;
+};